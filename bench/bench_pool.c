@@ -0,0 +1,185 @@
+/*
+ * Throughput benchmark for the thread pool hot paths.
+ *
+ * Each producer submits empty jobs (retrying while the ring is full) and the
+ * run ends when pool_wait() returns.
+ *
+ * Usage: bench_pool [matrix|scale|sort|mem] [jobs]
+ *   matrix  one line per (workers, producers) pair, `jobs` per producer
+ *   scale   1..128 threads split evenly between producers and workers, `jobs`
+ *           in total; shows how throughput holds up as contention on the
+ *           ring positions grows
+ *   sort    `jobs` random 64-bit keys: qsort() against pool_parallel_sort()
+ *           and pool_parallel_sort_u64() on 1..8 workers
+ *   mem     `jobs` MiB buffers: memcpy()/memset() against the pool versions
+ *           on 1..8 workers
+ *
+ * Cross-run on aarch64 with, e.g.:
+ *   make bench CC=aarch64-linux-gnu-gcc RUN="qemu-aarch64 -L /usr/aarch64-linux-gnu"
+ * qemu-user numbers are only meaningful relative to each other.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <time.h>
+#include "../thread_pool.h"
+#include "../pool_parallel.h"
+
+typedef struct {
+  pool_t *pool;
+  size_t jobs;
+} producer_args_t;
+
+static void empty_job(void *arg) { (void)arg; }
+
+static double now_sec(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+}
+
+static void *producer_thread(void *arg) {
+  producer_args_t *pa = (producer_args_t *)arg;
+  for (size_t i = 0; i < pa->jobs; ++i) {
+    while (pool_submit(pa->pool, empty_job, NULL) != 0) SPIN_HINT();
+  }
+  return NULL;
+}
+
+static double run(size_t workers, size_t producers, size_t jobs) {
+  pool_t *pool = pool_create(workers, 4096);
+  if (!pool) { fprintf(stderr, "pool_create failed\n"); exit(1); }
+
+  pthread_t threads[producers];
+  producer_args_t args[producers];
+  double start = now_sec();
+  for (size_t i = 0; i < producers; ++i) {
+    args[i].pool = pool;
+    args[i].jobs = jobs;
+    pthread_create(&threads[i], NULL, producer_thread, &args[i]);
+  }
+  for (size_t i = 0; i < producers; ++i) pthread_join(threads[i], NULL);
+  pool_wait(pool);
+  double elapsed = now_sec() - start;
+
+  pool_destroy(pool, 1);
+  return (double)(producers * jobs) / elapsed;
+}
+
+static void bench_matrix(size_t jobs) {
+  static const size_t workers[] = { 1, 2, 4, 8 };
+  static const size_t producers[] = { 1, 2, 4 };
+
+  printf("%8s %10s %14s\n", "workers", "producers", "Mjobs/s");
+  for (size_t w = 0; w < sizeof(workers) / sizeof(workers[0]); ++w) {
+    for (size_t p = 0; p < sizeof(producers) / sizeof(producers[0]); ++p) {
+      double rate = run(workers[w], producers[p], jobs);
+      printf("%8zu %10zu %14.2f\n", workers[w], producers[p], rate / 1e6);
+    }
+  }
+}
+
+static void bench_scale(size_t jobs) {
+  printf("%8s %8s %10s %14s\n", "threads", "workers", "producers", "Mjobs/s");
+  for (size_t threads = 1; threads <= 128; threads *= 2) {
+    size_t producers = threads / 2 ? threads / 2 : 1;
+    size_t workers = threads - threads / 2;
+    double rate = run(workers, producers, jobs / producers);
+    printf("%8zu %8zu %10zu %14.2f\n", threads, workers, producers, rate / 1e6);
+  }
+}
+
+static int cmp_u64(const void *a, const void *b) {
+  uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+  return (x > y) - (x < y);
+}
+
+static void fill_random(uint64_t *k, size_t n) {
+  uint64_t s = 88172645463325252ull;
+  for (size_t i = 0; i < n; ++i) {
+    s ^= s << 13; s ^= s >> 7; s ^= s << 17;
+    k[i] = s;
+  }
+}
+
+static void bench_sort(size_t n) {
+  uint64_t *k = malloc(n * sizeof(*k));
+  if (!k) { fprintf(stderr, "alloc failed\n"); exit(1); }
+
+  fill_random(k, n);
+  double start = now_sec();
+  qsort(k, n, sizeof(*k), cmp_u64);
+  double base = now_sec() - start;
+  printf("%8s %10s %10s %10s\n", "workers", "sort", "time_s", "vs_qsort");
+  printf("%8s %10s %10.3f %10.2f\n", "-", "qsort", base, 1.0);
+
+  for (size_t workers = 1; workers <= 8; workers *= 2) {
+    pool_t *pool = pool_create(workers, 1024);
+    if (!pool) { fprintf(stderr, "pool_create failed\n"); exit(1); }
+
+    fill_random(k, n);
+    start = now_sec();
+    pool_parallel_sort(pool, k, n, sizeof(*k), cmp_u64);
+    double merge = now_sec() - start;
+    printf("%8zu %10s %10.3f %10.2f\n", workers, "merge", merge, base / merge);
+
+    fill_random(k, n);
+    start = now_sec();
+    pool_parallel_sort_u64(pool, k, n);
+    double radix = now_sec() - start;
+    printf("%8zu %10s %10.3f %10.2f\n", workers, "radix", radix, base / radix);
+
+    pool_destroy(pool, 1);
+  }
+  free(k);
+}
+
+static void bench_mem(size_t mib) {
+  size_t n = mib << 20;
+  char *src = malloc(n), *dst = malloc(n);
+  if (!src || !dst) { fprintf(stderr, "alloc failed\n"); exit(1); }
+  memset(src, 1, n);
+  memcpy(dst, src, n);  // fault the pages in before timing
+
+  double start = now_sec();
+  memcpy(dst, src, n);
+  double cpy = now_sec() - start;
+  start = now_sec();
+  memset(dst, 2, n);
+  double set = now_sec() - start;
+  printf("%8s %12s %12s\n", "workers", "memcpy_GB/s", "memset_GB/s");
+  printf("%8s %12.2f %12.2f\n", "-", n / cpy / 1e9, n / set / 1e9);
+
+  for (size_t workers = 1; workers <= 8; workers *= 2) {
+    pool_t *pool = pool_create(workers, 1024);
+    if (!pool) { fprintf(stderr, "pool_create failed\n"); exit(1); }
+    start = now_sec();
+    pool_parallel_memcpy(pool, dst, src, n);
+    cpy = now_sec() - start;
+    start = now_sec();
+    pool_parallel_memset(pool, dst, 3, n);
+    set = now_sec() - start;
+    printf("%8zu %12.2f %12.2f\n", workers, n / cpy / 1e9, n / set / 1e9);
+    pool_destroy(pool, 1);
+  }
+  free(src);
+  free(dst);
+}
+
+int main(int argc, char **argv) {
+  const char *mode = argc > 1 ? argv[1] : "matrix";
+  size_t jobs = argc > 2 ? strtoul(argv[2], NULL, 10) : 200000;
+
+  if (strcmp(mode, "scale") == 0)
+    bench_scale(jobs);
+  else if (strcmp(mode, "sort") == 0)
+    bench_sort(jobs);
+  else if (strcmp(mode, "mem") == 0)
+    bench_mem(jobs);
+  else
+    bench_matrix(jobs);
+  return 0;
+}
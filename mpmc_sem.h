@@ -9,7 +9,9 @@
 #include <errno.h>
 #include <semaphore.h>
 #include <stdatomic.h>
+#include <stdint.h>
 #include <stdio.h>
+#include <time.h>
 
 // On macOS, unnamed semaphores are not supported.
 #ifdef __APPLE__
@@ -49,6 +51,20 @@ static inline void mpmc_sem_destroy(mpmc_sem_t *s) {
 
 static inline int mpmc_sem_post(mpmc_sem_t *s) { return sem_post(s->sem); }
 static inline int mpmc_sem_wait(mpmc_sem_t *s) { return sem_wait(s->sem); }
+static inline int mpmc_sem_trywait(mpmc_sem_t *s) { return sem_trywait(s->sem); }
+
+// Named semaphores have no timed wait on macOS: poll every 50us instead.
+static inline int mpmc_sem_timedwait(mpmc_sem_t *s, uint64_t ns) {
+  struct timespec step = { 0, 50000 };
+  for (;;) {
+    if (sem_trywait(s->sem) == 0) return 0;
+    if (ns == 0) return -1;
+    uint64_t nap = ns < 50000 ? ns : 50000;
+    step.tv_nsec = (long)nap;
+    nanosleep(&step, NULL);
+    ns -= nap;
+  }
+}
 
 #else
 
@@ -61,6 +77,21 @@ static inline int mpmc_sem_init(mpmc_sem_t *s, unsigned int value) {
 static inline void mpmc_sem_destroy(mpmc_sem_t *s) { sem_destroy(s); }
 static inline int mpmc_sem_post(mpmc_sem_t *s) { return sem_post(s); }
 static inline int mpmc_sem_wait(mpmc_sem_t *s) { return sem_wait(s); }
+static inline int mpmc_sem_trywait(mpmc_sem_t *s) { return sem_trywait(s); }
+
+// Wait at most `ns` nanoseconds. Returns 0 if the semaphore was taken, -1 on
+// timeout (or interruption; callers re-check their state either way).
+static inline int mpmc_sem_timedwait(mpmc_sem_t *s, uint64_t ns) {
+  struct timespec ts;
+  clock_gettime(CLOCK_REALTIME, &ts);
+  ts.tv_sec += (time_t)(ns / 1000000000u);
+  ts.tv_nsec += (long)(ns % 1000000000u);
+  if (ts.tv_nsec >= 1000000000L) {
+    ts.tv_nsec -= 1000000000L;
+    ++ts.tv_sec;
+  }
+  return sem_timedwait(s, &ts);
+}
 
 #endif
 
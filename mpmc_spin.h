@@ -0,0 +1,211 @@
+/*
+ * Spin-wait primitives for the MPMC queue.
+ *
+ * Budgets are expressed in nanoseconds. The cost of one SPIN_HINT() varies a
+ * lot between microarchitectures (x86 `pause` is ~10 cycles on some cores and
+ * ~140 on others), so it is measured once at startup by mpmc_spin_calibrate()
+ * together with the rate of the cycle counter used for deadlines.
+ */
+
+#ifndef MPMC_SPIN_H
+#define MPMC_SPIN_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <time.h>
+#include <sched.h>
+#include <unistd.h>
+#include <pthread.h>
+#include "thread_pool.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <cpuid.h>
+#include <x86intrin.h>
+#define MPMC_SPIN_X86 1
+#endif
+
+typedef struct {
+  uint64_t ticks_per_us;     // rate of mpmc_spin_ticks()
+  uint64_t pause_ticks;      // cost of one SPIN_HINT() in ticks (>= 1)
+  int waitpkg;               // x86 UMONITOR/UMWAIT/TPAUSE available
+  int single_cpu;            // spinning for another thread is pointless
+} mpmc_spin_cal_t;
+
+static mpmc_spin_cal_t mpmc_spin_cal;
+static pthread_once_t mpmc_spin_cal_once = PTHREAD_ONCE_INIT;
+
+static inline uint64_t mpmc_spin_clock_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+
+// Cheap monotonic tick counter: TSC on x86, the generic timer on aarch64,
+// nanoseconds elsewhere.
+static inline uint64_t mpmc_spin_ticks(void) {
+#if defined(MPMC_SPIN_X86)
+  return __rdtsc();
+#elif defined(__aarch64__)
+  uint64_t t;
+  __asm__ volatile("mrs %0, cntvct_el0" : "=r"(t));
+  return t;
+#else
+  return mpmc_spin_clock_ns();
+#endif
+}
+
+static inline uint64_t mpmc_spin_ns_to_ticks(uint64_t ns) {
+  return ns * mpmc_spin_cal.ticks_per_us / 1000u;
+}
+
+static void mpmc_spin_measure(void) {
+#if defined(MPMC_SPIN_X86)
+  unsigned a, b, c, d;
+  mpmc_spin_cal.waitpkg = __get_cpuid_count(7, 0, &a, &b, &c, &d) && (c & (1u << 5));
+  // Time the TSC against the monotonic clock over ~200us.
+  uint64_t ns0 = mpmc_spin_clock_ns(), t0 = __rdtsc(), ns1;
+  do { ns1 = mpmc_spin_clock_ns(); } while (ns1 - ns0 < 200000);
+  uint64_t per_us = (__rdtsc() - t0) * 1000u / (ns1 - ns0);
+  mpmc_spin_cal.ticks_per_us = per_us ? per_us : 1;
+#elif defined(__aarch64__)
+  uint64_t freq;
+  __asm__ volatile("mrs %0, cntfrq_el0" : "=r"(freq));
+  mpmc_spin_cal.ticks_per_us = freq / 1000000u ? freq / 1000000u : 1;
+#else
+  mpmc_spin_cal.ticks_per_us = 1000;
+#endif
+
+  enum { N = 2000 };
+  uint64_t t = mpmc_spin_ticks();
+  for (int i = 0; i < N; ++i) SPIN_HINT();
+  uint64_t pause = (mpmc_spin_ticks() - t) / N;
+  mpmc_spin_cal.pause_ticks = pause ? pause : 1;
+
+  mpmc_spin_cal.single_cpu = sysconf(_SC_NPROCESSORS_ONLN) <= 1;
+}
+
+// Measure the tick rate and SPIN_HINT() cost. Only the first call measures;
+// pthread_once() makes every caller, including ones that raced with it, wait
+// for the results and see them, so workers of one pool never read the
+// fields while another pool's creation writes them.
+static inline void mpmc_spin_calibrate(void) {
+  pthread_once(&mpmc_spin_cal_once, mpmc_spin_measure);
+}
+
+// Spin for about `ns` nanoseconds. Uses TPAUSE (light C0.1 state) where
+// available, otherwise a number of SPIN_HINT()s derived from their measured
+// cost, so the clock is not read in the loop.
+static inline void mpmc_spin_ns(uint64_t ns) {
+#if defined(MPMC_SPIN_X86)
+  if (mpmc_spin_cal.waitpkg) {
+    uint64_t deadline = __rdtsc() + mpmc_spin_ns_to_ticks(ns);
+    __asm__ volatile("tpause %%ecx" :: "c"(1u), "a"((uint32_t)deadline),
+                     "d"((uint32_t)(deadline >> 32)) : "memory", "cc");
+    return;
+  }
+#endif
+  uint64_t n = mpmc_spin_ns_to_ticks(ns) / mpmc_spin_cal.pause_ticks;
+  for (uint64_t i = 0; i < n; ++i) SPIN_HINT();
+}
+
+// Wait until `*addr` no longer holds `old`, for at most about `ns`
+// nanoseconds. Returns early as soon as the value changes; may also return
+// with the value unchanged, so callers always re-check with their own
+// ordering.
+//
+// Rather than hammering the line with loads:
+// - x86 with WAITPKG arms UMONITOR on the line and sleeps in UMWAIT (C0.1)
+//   until it is written or the deadline passes;
+// - aarch64 arms the exclusive monitor with LDAXR and sleeps in WFE until
+//   another core writes the line (or the kernel's event stream fires);
+// - otherwise the word is polled with SPIN_HINT() between loads.
+static inline void mpmc_spin_until_change(atomic_size_t *addr, size_t old, uint64_t ns) {
+  uint64_t deadline = mpmc_spin_ticks() + mpmc_spin_ns_to_ticks(ns);
+#if defined(MPMC_SPIN_X86)
+  if (mpmc_spin_cal.waitpkg) {
+    do {
+      __asm__ volatile("umonitor %0" :: "r"(addr) : "memory");
+      if (atomic_load_explicit(addr, memory_order_relaxed) != old) return;
+      __asm__ volatile("umwait %%ecx" :: "c"(1u), "a"((uint32_t)deadline),
+                       "d"((uint32_t)(deadline >> 32)) : "memory", "cc");
+    } while (atomic_load_explicit(addr, memory_order_relaxed) == old &&
+             mpmc_spin_ticks() < deadline);
+    return;
+  }
+#endif
+#if defined(__aarch64__)
+  do {
+    size_t cur;
+    __asm__ volatile("ldaxr %0, [%1]" : "=&r"(cur) : "r"(addr) : "memory");
+    if (cur != old) return;
+    __asm__ volatile("wfe" ::: "memory");
+  } while (mpmc_spin_ticks() < deadline);
+#else
+  do {
+    if (atomic_load_explicit(addr, memory_order_relaxed) != old) return;
+    SPIN_HINT();
+  } while (mpmc_spin_ticks() < deadline);
+#endif
+}
+
+/* ---------------- Backoff ---------------- */
+
+// State of one wait under a pool_backoff_t policy.
+typedef struct {
+  const pool_backoff_t *policy;
+  unsigned round;
+  uint64_t spun_ns;
+  uint32_t rng;
+} mpmc_backoff_t;
+
+static inline void mpmc_backoff_init(mpmc_backoff_t *b, const pool_backoff_t *policy) {
+  b->policy = policy;
+  b->round = 0;
+  b->spun_ns = 0;
+  b->rng = (uint32_t)(mpmc_spin_ticks() ^ (uintptr_t)b) | 1u;
+}
+
+// Length of the next wait in ns. `distance` is only used by PROPORTIONAL.
+static inline uint64_t mpmc_backoff_next_ns(mpmc_backoff_t *b, size_t distance) {
+  const pool_backoff_t *p = b->policy;
+  uint64_t ns;
+  switch (p->kind) {
+  case POOL_BACKOFF_FIXED:
+    ns = p->min_ns;
+    break;
+  case POOL_BACKOFF_PROPORTIONAL:
+    ns = (uint64_t)p->min_ns * (distance ? distance : 1);
+    break;
+  default:
+    ns = b->round < 32 ? (uint64_t)p->min_ns << b->round : p->max_ns;
+    break;
+  }
+  if (ns > p->max_ns) ns = p->max_ns;
+  if (p->jitter && ns > 1) {
+    b->rng ^= b->rng << 13;
+    b->rng ^= b->rng >> 17;
+    b->rng ^= b->rng << 5;
+    ns = ns / 2 + b->rng % (ns / 2 + 1);
+  }
+  ++b->round;
+  return ns;
+}
+
+// One round of waiting. If `addr` is non-NULL the round ends early once
+// `*addr` changes from `old`. After the spin limit, yields instead.
+static inline void mpmc_backoff_wait(mpmc_backoff_t *b, size_t distance,
+                                     atomic_size_t *addr, size_t old) {
+  if (b->spun_ns >= b->policy->spin_limit_ns || mpmc_spin_cal.single_cpu) {
+    sched_yield();
+    return;
+  }
+  uint64_t ns = mpmc_backoff_next_ns(b, distance);
+  if (addr)
+    mpmc_spin_until_change(addr, old, ns);
+  else
+    mpmc_spin_ns(ns);
+  b->spun_ns += ns;
+}
+
+#endif // MPMC_SPIN_H
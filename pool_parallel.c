@@ -0,0 +1,521 @@
+/*
+ * Parallel algorithms built on the thread pool, see pool_parallel.h.
+ *
+ * Everything here uses the public pool API only. Work is split recursively
+ * with pool_spawn() / pool_sync(): frames and tasks live on the stack, and a
+ * worker that syncs runs other pieces instead of blocking.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include "pool_parallel.h"
+
+#if defined(__x86_64__) || (defined(__i386__) && defined(__SSE2__))
+#include <emmintrin.h>
+#define PAR_NT_X86 1
+#endif
+
+/* ---------------- Merge sort ---------------- */
+
+// Below this many bytes a range is sorted or merged sequentially: about
+// what fits in L2, so the base case runs in cache.
+#define SORT_SEQ_BYTES (64u * 1024u)
+// Runs of at most this many elements are insertion sorted.
+#define SORT_RUN 16
+
+typedef struct {
+  size_t size;
+  int (*cmp)(const void *, const void *);
+} sort_ctx_t;
+
+// Insertion sort `n` elements from `src` into `dst` (which may not overlap).
+static void sort_run(const sort_ctx_t *c, const char *src, char *dst, size_t n) {
+  size_t size = c->size;
+  for (size_t i = 0; i < n; ++i) {
+    const char *x = src + i * size;
+    size_t j = i;
+    while (j > 0 && c->cmp(dst + (j - 1) * size, x) > 0) --j;
+    memmove(dst + (j + 1) * size, dst + j * size, (i - j) * size);
+    memcpy(dst + j * size, x, size);
+  }
+}
+
+static void merge_seq(const sort_ctx_t *c, const char *a, size_t na,
+                      const char *b, size_t nb, char *dst) {
+  size_t size = c->size;
+  const char *a_end = a + na * size, *b_end = b + nb * size;
+  while (a < a_end && b < b_end) {
+    if (c->cmp(b, a) < 0) {
+      memcpy(dst, b, size);
+      b += size;
+    } else {
+      memcpy(dst, a, size);
+      a += size;
+    }
+    dst += size;
+  }
+  memcpy(dst, a, (size_t)(a_end - a));
+  memcpy(dst + (a_end - a), b, (size_t)(b_end - b));
+}
+
+// Sort `n` elements of `a` using `b` (same length) as scratch. The result
+// ends up in `b` if `into_b`, else in `a`.
+static void msort_seq(const sort_ctx_t *c, char *a, char *b, size_t n, int into_b) {
+  if (n <= SORT_RUN) {
+    sort_run(c, a, b, n);
+    if (!into_b) memcpy(a, b, n * c->size);
+    return;
+  }
+  size_t half = n / 2, off = half * c->size;
+  msort_seq(c, a, b, half, !into_b);
+  msort_seq(c, a + off, b + off, n - half, !into_b);
+  if (into_b)
+    merge_seq(c, a, half, a + off, n - half, b);
+  else
+    merge_seq(c, b, half, b + off, n - half, a);
+}
+
+typedef struct {
+  pool_t *pool;
+  const sort_ctx_t *ctx;
+  const char *a, *b;
+  size_t na, nb;
+  char *dst;
+} merge_args_t;
+
+// First element of the sorted range [base, base + n) not less than `key`.
+static size_t lower_bound(const sort_ctx_t *c, const char *base, size_t n, const char *key) {
+  size_t lo = 0, hi = n;
+  while (lo < hi) {
+    size_t mid = lo + (hi - lo) / 2;
+    if (c->cmp(base + mid * c->size, key) < 0) lo = mid + 1; else hi = mid;
+  }
+  return lo;
+}
+
+// Merge two sorted ranges into `dst`, in parallel: split the larger range in
+// half, find the split point in the other by binary search, and merge the two
+// pairs of halves independently.
+static void merge_job(void *arg) {
+  merge_args_t *m = (merge_args_t *)arg;
+  const sort_ctx_t *c = m->ctx;
+  if ((m->na + m->nb) * c->size <= SORT_SEQ_BYTES) {
+    merge_seq(c, m->a, m->na, m->b, m->nb, m->dst);
+    return;
+  }
+  const char *big = m->a, *small = m->b;
+  size_t nbig = m->na, nsmall = m->nb;
+  if (nbig < nsmall) {
+    big = m->b; small = m->a;
+    nbig = m->nb; nsmall = m->na;
+  }
+  size_t i = nbig / 2;
+  size_t j = lower_bound(c, small, nsmall, big + i * c->size);
+
+  merge_args_t lo = { m->pool, c, big, small, i, j, m->dst };
+  merge_args_t hi = { m->pool, c, big + i * c->size, small + j * c->size,
+                      nbig - i, nsmall - j, m->dst + (i + j) * c->size };
+  pool_frame_t frame;
+  pool_task_t task;
+  pool_frame_init(&frame, m->pool);
+  pool_spawn(&frame, &task, merge_job, &lo);
+  merge_job(&hi);
+  pool_sync(&frame);
+}
+
+typedef struct {
+  pool_t *pool;
+  const sort_ctx_t *ctx;
+  char *a, *b;
+  size_t n;
+  int into_b;
+} msort_args_t;
+
+// Parallel version of msort_seq().
+static void msort_job(void *arg) {
+  msort_args_t *s = (msort_args_t *)arg;
+  const sort_ctx_t *c = s->ctx;
+  if (s->n * c->size <= SORT_SEQ_BYTES) {
+    msort_seq(c, s->a, s->b, s->n, s->into_b);
+    return;
+  }
+  size_t half = s->n / 2, off = half * c->size;
+  msort_args_t lo = { s->pool, c, s->a, s->b, half, !s->into_b };
+  msort_args_t hi = { s->pool, c, s->a + off, s->b + off, s->n - half, !s->into_b };
+  pool_frame_t frame;
+  pool_task_t task;
+  pool_frame_init(&frame, s->pool);
+  pool_spawn(&frame, &task, msort_job, &lo);
+  msort_job(&hi);
+  pool_sync(&frame);
+
+  char *src = s->into_b ? s->a : s->b, *dst = s->into_b ? s->b : s->a;
+  merge_args_t m = { s->pool, c, src, src + off, half, s->n - half, dst };
+  merge_job(&m);
+}
+
+int pool_parallel_sort(pool_t *pool, void *base, size_t n, size_t size,
+                       int (*cmp)(const void *, const void *)) {
+  if (n < 2 || size == 0) return 0;
+  char *scratch = malloc(n * size);
+  if (!scratch) return -1;
+  sort_ctx_t ctx = { size, cmp };
+  msort_args_t s = { pool, &ctx, (char *)base, scratch, n, 0 };
+  msort_job(&s);
+  free(scratch);
+  return 0;
+}
+
+/* ---------------- Radix sort ---------------- */
+
+#define RADIX_BITS 8
+#define RADIX_BUCKETS (1u << RADIX_BITS)
+// Keys per chunk, and at most this many chunks.
+#define RADIX_CHUNK 65536u
+#define RADIX_MAX_CHUNKS 64
+// Below this many keys a single chunk is used.
+#define RADIX_SEQ 4096u
+
+typedef struct {
+  pool_t *pool;
+  const uint64_t *src;
+  uint64_t *dst;
+  size_t begin, end;
+  unsigned shift;
+  size_t *count;  // RADIX_BUCKETS counters: histogram, then scatter offsets
+} radix_chunk_t;
+
+static void radix_count_job(void *arg) {
+  radix_chunk_t *r = (radix_chunk_t *)arg;
+  memset(r->count, 0, RADIX_BUCKETS * sizeof(size_t));
+  for (size_t i = r->begin; i < r->end; ++i)
+    ++r->count[(r->src[i] >> r->shift) & (RADIX_BUCKETS - 1)];
+}
+
+static void radix_scatter_job(void *arg) {
+  radix_chunk_t *r = (radix_chunk_t *)arg;
+  for (size_t i = r->begin; i < r->end; ++i) {
+    uint64_t k = r->src[i];
+    r->dst[r->count[(k >> r->shift) & (RADIX_BUCKETS - 1)]++] = k;
+  }
+}
+
+// Run `fn` on every chunk, one task each.
+static void radix_for_chunks(pool_t *pool, radix_chunk_t *chunks, size_t nchunks, job_fn fn) {
+  pool_frame_t frame;
+  pool_task_t tasks[RADIX_MAX_CHUNKS];
+  pool_frame_init(&frame, pool);
+  for (size_t i = 1; i < nchunks; ++i) pool_spawn(&frame, &tasks[i], fn, &chunks[i]);
+  fn(&chunks[0]);
+  pool_sync(&frame);
+}
+
+int pool_parallel_sort_u64(pool_t *pool, uint64_t *keys, size_t n) {
+  if (n < 2) return 0;
+  size_t nchunks = n < RADIX_SEQ ? 1 : (n + RADIX_CHUNK - 1) / RADIX_CHUNK;
+  if (nchunks > RADIX_MAX_CHUNKS) nchunks = RADIX_MAX_CHUNKS;
+  uint64_t *scratch = malloc(n * sizeof(uint64_t));
+  size_t *counts = malloc(nchunks * RADIX_BUCKETS * sizeof(size_t));
+  if (!scratch || !counts) {
+    free(scratch);
+    free(counts);
+    return -1;
+  }
+
+  radix_chunk_t chunks[RADIX_MAX_CHUNKS];
+  uint64_t *src = keys, *dst = scratch;
+  for (unsigned shift = 0; shift < 64; shift += RADIX_BITS) {
+    for (size_t c = 0; c < nchunks; ++c) {
+      radix_chunk_t r = { pool, src, dst, n * c / nchunks, n * (c + 1) / nchunks,
+                          shift, counts + c * RADIX_BUCKETS };
+      chunks[c] = r;
+    }
+    radix_for_chunks(pool, chunks, nchunks, radix_count_job);
+
+    // Turn the per-chunk histograms into scatter offsets: bucket-major, then
+    // chunk order, which keeps each pass stable. A digit shared by every key
+    // moves nothing, so its pass is skipped.
+    size_t total = 0;
+    int skip = 0;
+    for (unsigned d = 0; d < RADIX_BUCKETS && !skip; ++d) {
+      size_t in_bucket = 0;
+      for (size_t c = 0; c < nchunks; ++c) {
+        size_t cnt = chunks[c].count[d];
+        chunks[c].count[d] = total;
+        total += cnt;
+        in_bucket += cnt;
+      }
+      skip = in_bucket == n;
+    }
+    if (skip) continue;
+
+    radix_for_chunks(pool, chunks, nchunks, radix_scatter_job);
+    uint64_t *t = src; src = dst; dst = t;
+  }
+  if (src != keys) memcpy(keys, src, n * sizeof(uint64_t));
+
+  free(scratch);
+  free(counts);
+  return 0;
+}
+
+/* ---------------- Memory operations ---------------- */
+
+#define PAR_PAGE 4096u
+// Work per task: large enough to amortize the spawn, small enough to spread.
+#define PAR_MEM_CHUNK (256u * 1024u)
+// Below this a single thread is as fast.
+#define PAR_MEM_MIN (1024u * 1024u)
+// From this size on, stores are non-temporal: bigger than a typical LLC.
+#ifndef POOL_PARALLEL_NT_BYTES
+#define POOL_PARALLEL_NT_BYTES (32u * 1024u * 1024u)
+#endif
+
+typedef struct {
+  pool_t *pool;
+  char *dst;
+  const char *src;  // NULL for memset
+  int c;
+  size_t first, n_chunks;  // chunk range, see mem_chunk_bounds()
+  size_t total;
+  int nt;
+} mem_args_t;
+
+// Byte range of chunk `i`: chunk 0 runs up to the first page boundary of dst
+// past PAR_MEM_CHUNK, the others are whole chunks starting on page boundaries.
+static void mem_chunk_bounds(const mem_args_t *m, size_t i, size_t *begin, size_t *end) {
+  size_t head = (PAR_PAGE - ((uintptr_t)m->dst & (PAR_PAGE - 1))) & (PAR_PAGE - 1);
+  size_t b = i == 0 ? 0 : head + i * PAR_MEM_CHUNK;
+  size_t e = head + (i + 1) * PAR_MEM_CHUNK;
+  *begin = b < m->total ? b : m->total;
+  *end = e < m->total ? e : m->total;
+}
+
+static void copy_nt(char *dst, const char *src, size_t n) {
+#if defined(PAR_NT_X86)
+  size_t lead = (16 - ((uintptr_t)dst & 15)) & 15;
+  if (lead > n) lead = n;
+  memcpy(dst, src, lead);
+  dst += lead; src += lead; n -= lead;
+  for (; n >= 64; n -= 64, dst += 64, src += 64) {
+    __m128i a = _mm_loadu_si128((const __m128i *)src);
+    __m128i b = _mm_loadu_si128((const __m128i *)(src + 16));
+    __m128i c = _mm_loadu_si128((const __m128i *)(src + 32));
+    __m128i d = _mm_loadu_si128((const __m128i *)(src + 48));
+    _mm_stream_si128((__m128i *)dst, a);
+    _mm_stream_si128((__m128i *)(dst + 16), b);
+    _mm_stream_si128((__m128i *)(dst + 32), c);
+    _mm_stream_si128((__m128i *)(dst + 48), d);
+  }
+  // Streaming stores are weakly ordered: fence them before the task's
+  // completion is published.
+  _mm_sfence();
+#elif defined(__aarch64__)
+  for (; n >= 32; n -= 32, dst += 32, src += 32) {
+    __asm__ volatile("ldp q0, q1, [%1]\n\tstnp q0, q1, [%0]"
+                     :: "r"(dst), "r"(src) : "v0", "v1", "memory");
+  }
+#endif
+  memcpy(dst, src, n);
+}
+
+static void set_nt(char *dst, int c, size_t n) {
+#if defined(PAR_NT_X86)
+  size_t lead = (16 - ((uintptr_t)dst & 15)) & 15;
+  if (lead > n) lead = n;
+  memset(dst, c, lead);
+  dst += lead; n -= lead;
+  __m128i v = _mm_set1_epi8((char)c);
+  for (; n >= 64; n -= 64, dst += 64) {
+    _mm_stream_si128((__m128i *)dst, v);
+    _mm_stream_si128((__m128i *)(dst + 16), v);
+    _mm_stream_si128((__m128i *)(dst + 32), v);
+    _mm_stream_si128((__m128i *)(dst + 48), v);
+  }
+  _mm_sfence();
+#elif defined(__aarch64__)
+  for (; n >= 32; n -= 32, dst += 32) {
+    __asm__ volatile("dup v0.16b, %w1\n\tstnp q0, q0, [%0]"
+                     :: "r"(dst), "r"(c) : "v0", "memory");
+  }
+#endif
+  memset(dst, c, n);
+}
+
+// Process a range of chunks, halving it between a spawned task and this one
+// so no single thread has to spawn them all.
+static void mem_job(void *arg) {
+  mem_args_t *m = (mem_args_t *)arg;
+  if (m->n_chunks > 1) {
+    size_t half = m->n_chunks / 2;
+    mem_args_t hi = *m;
+    hi.first += half;
+    hi.n_chunks -= half;
+    mem_args_t lo = *m;
+    lo.n_chunks = half;
+    pool_frame_t frame;
+    pool_task_t task;
+    pool_frame_init(&frame, m->pool);
+    pool_spawn(&frame, &task, mem_job, &hi);
+    mem_job(&lo);
+    pool_sync(&frame);
+    return;
+  }
+  size_t begin, end;
+  mem_chunk_bounds(m, m->first, &begin, &end);
+  if (m->src) {
+    if (m->nt) copy_nt(m->dst + begin, m->src + begin, end - begin);
+    else memcpy(m->dst + begin, m->src + begin, end - begin);
+  } else {
+    if (m->nt) set_nt(m->dst + begin, m->c, end - begin);
+    else memset(m->dst + begin, m->c, end - begin);
+  }
+}
+
+static void mem_run(pool_t *pool, void *dst, const void *src, int c, size_t n) {
+  mem_args_t m = { pool, (char *)dst, (const char *)src, c, 0, 0, n,
+                   n >= POOL_PARALLEL_NT_BYTES };
+  size_t head, end;
+  mem_chunk_bounds(&m, 0, &head, &end);
+  m.n_chunks = 1 + (n - end + PAR_MEM_CHUNK - 1) / PAR_MEM_CHUNK;
+  mem_job(&m);
+}
+
+void *pool_parallel_memcpy(pool_t *pool, void *dst, const void *src, size_t n) {
+  if (n < PAR_MEM_MIN) return memcpy(dst, src, n);
+  mem_run(pool, dst, src, 0, n);
+  return dst;
+}
+
+void *pool_parallel_memset(pool_t *pool, void *dst, int c, size_t n) {
+  if (n < PAR_MEM_MIN) return memset(dst, c, n);
+  mem_run(pool, dst, NULL, c, n);
+  return dst;
+}
+
+/* ---------------- Map ---------------- */
+
+// Chunk edges are placed on multiples of this in `out`: a cache line, which
+// is also the widest vector register (AVX-512).
+#define MAP_ALIGN 64u
+// Target bytes of output per chunk.
+#define MAP_CHUNK_BYTES (64u * 1024u)
+
+typedef struct {
+  pool_t *pool;
+  const char *in;
+  char *out;
+  size_t elem;
+  pool_map_fn fn;
+  void *arg;
+  size_t n;        // elements in total
+  size_t head;     // elements before the first aligned edge
+  size_t chunk;    // elements per chunk after the head
+  size_t first, n_chunks;  // chunk range of this task; chunk 0 is the head
+} map_args_t;
+
+static size_t gcd(size_t a, size_t b) {
+  while (b) { size_t t = a % b; a = b; b = t; }
+  return a;
+}
+
+static void map_job(void *arg) {
+  map_args_t *m = (map_args_t *)arg;
+  if (m->n_chunks > 1) {
+    size_t half = m->n_chunks / 2;
+    map_args_t hi = *m;
+    hi.first += half;
+    hi.n_chunks -= half;
+    map_args_t lo = *m;
+    lo.n_chunks = half;
+    pool_frame_t frame;
+    pool_task_t task;
+    pool_frame_init(&frame, m->pool);
+    pool_spawn(&frame, &task, map_job, &hi);
+    map_job(&lo);
+    pool_sync(&frame);
+    return;
+  }
+  size_t begin = m->first == 0 ? 0 : m->head + (m->first - 1) * m->chunk;
+  size_t end = m->first == 0 ? m->head : begin + m->chunk;
+  if (end > m->n) end = m->n;
+  if (begin < end)
+    m->fn(m->in + begin * m->elem, m->out + begin * m->elem, end - begin, m->arg);
+}
+
+void pool_parallel_map(pool_t *pool, const void *in, void *out, size_t n,
+                       size_t elem_size, pool_map_fn fn, void *arg) {
+  if (n == 0 || elem_size == 0) return;
+  // Edges advance in steps of `step` elements, the fewest that span a whole
+  // number of MAP_ALIGN-byte lines. The first edge is the first element that
+  // starts a line, if any does; otherwise (`out` is misaligned for its
+  // element size) edges cannot avoid sharing lines and start at 0.
+  size_t step = MAP_ALIGN / gcd(MAP_ALIGN, elem_size);
+  size_t head = 0;
+  for (size_t i = 0; i < step; ++i) {
+    if (((uintptr_t)out + i * elem_size) % MAP_ALIGN == 0) {
+      head = i;
+      break;
+    }
+  }
+  size_t chunk = MAP_CHUNK_BYTES / elem_size;
+  chunk = chunk < step ? step : chunk - chunk % step;
+  if (head > n) head = n;
+
+  map_args_t m = { pool, (const char *)in, (char *)out, elem_size, fn, arg, n,
+                   head, chunk, 0, 1 + (n - head + chunk - 1) / chunk };
+  map_job(&m);
+}
+
+/* ---------------- Reduce ---------------- */
+
+typedef struct {
+  pool_t *pool;
+  size_t n, grain, acc_size;
+  pool_reduce_leaf_fn leaf;
+  pool_reduce_combine_fn combine;
+  void *arg;
+  char *partials;       // one accumulator per block
+  size_t lo, hi;        // block range of this task
+} reduce_args_t;
+
+// Reduce blocks [lo, hi) into the partial of block `lo`. The split point is
+// the midpoint of the block range, so the tree is fixed by n and grain.
+static void reduce_job(void *arg) {
+  reduce_args_t *r = (reduce_args_t *)arg;
+  if (r->hi - r->lo == 1) {
+    size_t begin = r->lo * r->grain;
+    size_t end = begin + r->grain < r->n ? begin + r->grain : r->n;
+    r->leaf(begin, end, r->partials + r->lo * r->acc_size, r->arg);
+    return;
+  }
+  size_t mid = r->lo + (r->hi - r->lo) / 2;
+  reduce_args_t left = *r, right = *r;
+  left.hi = mid;
+  right.lo = mid;
+  pool_frame_t frame;
+  pool_task_t task;
+  pool_frame_init(&frame, r->pool);
+  pool_spawn(&frame, &task, reduce_job, &right);
+  reduce_job(&left);
+  pool_sync(&frame);
+  r->combine(r->partials + r->lo * r->acc_size, r->partials + mid * r->acc_size, r->arg);
+}
+
+int pool_parallel_reduce(pool_t *pool, size_t n, size_t grain, size_t acc_size,
+                         pool_reduce_leaf_fn leaf, pool_reduce_combine_fn combine,
+                         void *result, void *arg) {
+  if (grain == 0) grain = 1;
+  if (n <= grain) {
+    leaf(0, n, result, arg);
+    return 0;
+  }
+  size_t blocks = (n + grain - 1) / grain;
+  char *partials = malloc(blocks * acc_size);
+  if (!partials) return -1;
+  reduce_args_t r = { pool, n, grain, acc_size, leaf, combine, arg, partials, 0, blocks };
+  reduce_job(&r);
+  memcpy(result, partials, acc_size);
+  free(partials);
+  return 0;
+}
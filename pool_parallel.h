@@ -0,0 +1,68 @@
+/*
+ * Parallel algorithms built on the thread pool.
+ *
+ * Each call splits its work with pool_spawn() / pool_sync() and returns once
+ * it is done. They may be called from outside the pool or from inside a job.
+ *
+ * Usage:
+ *   pool_parallel_sort(p, items, n, sizeof(*items), cmp_items);
+ */
+
+#ifndef POOL_PARALLEL_H
+#define POOL_PARALLEL_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "thread_pool.h"
+
+// Sort `n` elements of `size` bytes at `base` with `cmp` (as for qsort()):
+// a parallel merge sort with parallel merges and a sequential merge sort as
+// the base case. Not stable. Returns 0 on success, -1 if the n * size bytes
+// of scratch space could not be allocated (the array is left unchanged).
+int pool_parallel_sort(pool_t *pool, void *base, size_t n, size_t size,
+                       int (*cmp)(const void *, const void *));
+
+// Sort `n` unsigned 64-bit keys in ascending order with a parallel LSD radix
+// sort, skipping digits that are equal in every key. Returns 0 on success,
+// -1 if scratch space could not be allocated (the keys are left unchanged).
+int pool_parallel_sort_u64(pool_t *pool, uint64_t *keys, size_t n);
+
+// memcpy() / memset() for large buffers, split across the workers in
+// page-aligned chunks of the destination. Each chunk is written by the
+// worker that takes it, so fresh pages are first touched (and placed) on that
+// worker's NUMA node. Past POOL_PARALLEL_NT_BYTES the copy bypasses the
+// caches with non-temporal stores, since the destination would not fit in
+// them anyway. Small buffers are handled inline. Return `dst`.
+void *pool_parallel_memcpy(pool_t *pool, void *dst, const void *src, size_t n);
+void *pool_parallel_memset(pool_t *pool, void *dst, int c, size_t n);
+
+// Kernel for pool_parallel_map(): transform `count` consecutive elements of
+// `in` into `out`. Called once per chunk, so a plain loop over the chunk can
+// be vectorized by the compiler.
+typedef void (*pool_map_fn)(const void *in, void *out, size_t count, void *arg);
+
+// Apply `fn` to `n` elements of `elem_size` bytes, in parallel over chunks.
+// Chunk edges fall on cache-line (and so vector-width) boundaries of `out`
+// wherever its alignment allows, so no two workers write the same cache line
+// and every chunk but the first starts aligned. `in` and `out` may be equal.
+void pool_parallel_map(pool_t *pool, const void *in, void *out, size_t n,
+                       size_t elem_size, pool_map_fn fn, void *arg);
+
+// Callbacks for pool_parallel_reduce(). `leaf` computes the partial result
+// of elements [begin, end) into `acc` from scratch (an empty range gives the
+// identity); `combine` folds `right` into `left`, where `right` covers the
+// elements just after those of `left`.
+typedef void (*pool_reduce_leaf_fn)(size_t begin, size_t end, void *acc, void *arg);
+typedef void (*pool_reduce_combine_fn)(void *left, const void *right, void *arg);
+
+// Reduce `n` elements into `result` (`acc_size` bytes) in parallel. The range
+// is cut into blocks of `grain` elements and partials are combined along a
+// fixed binary tree over the blocks, so the order of every leaf and combine
+// depends only on `n` and `grain`, never on scheduling or the number of
+// workers: floating-point results are bitwise reproducible. Returns 0 on
+// success, -1 if the per-block partials could not be allocated.
+int pool_parallel_reduce(pool_t *pool, size_t n, size_t grain, size_t acc_size,
+                         pool_reduce_leaf_fn leaf, pool_reduce_combine_fn combine,
+                         void *result, void *arg);
+
+#endif // POOL_PARALLEL_H
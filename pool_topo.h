@@ -0,0 +1,123 @@
+
+/*
+ * CPU cache topology for the thread pool's steal order.
+ *
+ * Each CPU gets three group ids read from sysfs: its SMT core, its last-level
+ * cache (L3, or a CCX on AMD parts) and its NUMA node. Two CPUs are as close
+ * as the first group they share. Where sysfs is missing every pair of CPUs
+ * counts as sharing the LLC, which makes the steal order flat.
+ */
+
+#ifndef POOL_TOPO_H
+#define POOL_TOPO_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#ifdef __linux__
+#include <dirent.h>
+#include <sched.h>
+#endif
+
+// Distance levels, nearest first.
+enum { POOL_TOPO_SMT, POOL_TOPO_LLC, POOL_TOPO_NODE, POOL_TOPO_REMOTE, POOL_TOPO_LEVELS };
+
+typedef struct {
+  int n_cpus;
+  int *smt;   // first CPU of each CPU's core
+  int *llc;   // first CPU sharing each CPU's last-level cache
+  int *node;  // NUMA node of each CPU
+} pool_topo_t;
+
+// CPU the calling thread runs on, or -1 if unknown.
+static inline int pool_topo_cpu(void) {
+#ifdef __linux__
+  return sched_getcpu();
+#else
+  return -1;
+#endif
+}
+
+#ifdef __linux__
+// First number in a sysfs file such as a cpu list ("0-3,8-11"), or `dflt`.
+static inline int pool_topo_read_first(const char *path, int dflt) {
+  FILE *f = fopen(path, "r");
+  if (!f) return dflt;
+  int v;
+  if (fscanf(f, "%d", &v) != 1) v = dflt;
+  fclose(f);
+  return v;
+}
+
+static inline int pool_topo_node_of(int cpu) {
+  char path[64];
+  snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d", cpu);
+  DIR *d = opendir(path);
+  if (!d) return 0;
+  int node = 0;
+  struct dirent *e;
+  while ((e = readdir(d)) != NULL) {
+    if (strncmp(e->d_name, "node", 4) == 0 && sscanf(e->d_name + 4, "%d", &node) == 1) break;
+  }
+  closedir(d);
+  return node;
+}
+
+static inline int pool_topo_llc_of(int cpu) {
+  char path[96];
+  int best_level = 0, llc = 0;
+  for (int i = 0; i < 16; ++i) {
+    snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/cache/index%d/level", cpu, i);
+    int level = pool_topo_read_first(path, -1);
+    if (level < 0) break;
+    if (level <= best_level) continue;
+    snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/cache/index%d/shared_cpu_list", cpu, i);
+    best_level = level;
+    llc = pool_topo_read_first(path, 0);
+  }
+  return llc;
+}
+#endif
+
+// Read the topology. Returns -1 (leaving a flat topology) on failure.
+static inline int pool_topo_load(pool_topo_t *t) {
+  memset(t, 0, sizeof(*t));
+#ifdef __linux__
+  long n = sysconf(_SC_NPROCESSORS_CONF);
+  if (n < 1) return -1;
+  int *ids = malloc(3 * (size_t)n * sizeof(int));
+  if (!ids) return -1;
+  t->smt = ids;
+  t->llc = ids + n;
+  t->node = ids + 2 * n;
+  for (int c = 0; c < n; ++c) {
+    char path[96];
+    snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/topology/thread_siblings_list", c);
+    t->smt[c] = pool_topo_read_first(path, c);
+    t->llc[c] = pool_topo_llc_of(c);
+    t->node[c] = pool_topo_node_of(c);
+  }
+  t->n_cpus = (int)n;
+  return 0;
+#else
+  return -1;
+#endif
+}
+
+static inline void pool_topo_free(pool_topo_t *t) {
+  free(t->smt);
+  memset(t, 0, sizeof(*t));
+}
+
+// Distance level between two CPUs. Unknown CPUs share the LLC.
+static inline int pool_topo_distance(const pool_topo_t *t, int a, int b) {
+  if (a < 0 || b < 0 || a >= t->n_cpus || b >= t->n_cpus) return POOL_TOPO_LLC;
+  if (t->smt[a] == t->smt[b]) return POOL_TOPO_SMT;
+  if (t->llc[a] == t->llc[b]) return POOL_TOPO_LLC;
+  if (t->node[a] == t->node[b]) return POOL_TOPO_NODE;
+  return POOL_TOPO_REMOTE;
+}
+
+#endif // POOL_TOPO_H
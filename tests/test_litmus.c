@@ -0,0 +1,352 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <sched.h>
+
+// Include implementation to access internal APIs and types.
+#include "../thread_pool.c"
+
+/*
+ * Litmus-style tests for the orderings documented at the top of the thread
+ * pool section in thread_pool.c. Each test is a message-passing pattern whose
+ * payload is a plain (non-atomic) write that is only safe to read if the
+ * ordering it names holds. On x86 they pass regardless; they are meant to be
+ * run on weakly ordered hardware (aarch64, natively or under qemu-user).
+ */
+
+#define TEST_ASSERT(cond, msg) do { \
+  if (!(cond)) { \
+    fprintf(stderr, "FAIL: %s (%s:%d)\n", msg, __FILE__, __LINE__); \
+    exit(1); \
+  } \
+} while (0)
+
+#define ROUNDS 20000
+
+typedef struct {
+  size_t payload;
+  size_t expect;
+  atomic_int bad;
+} mp_cell_t;
+
+// seq release (enqueue) -> seq acquire (dequeue): the job sees data written
+// before it was submitted.
+static void read_payload_job(void *arg) {
+  mp_cell_t *c = (mp_cell_t *)arg;
+  if (c->payload != c->expect) atomic_store_explicit(&c->bad, 1, memory_order_relaxed);
+}
+
+static void test_submit_publishes_arg(void) {
+  pool_t *p = pool_create(2, 64);
+  TEST_ASSERT(p != NULL, "pool create");
+
+  mp_cell_t *cells = calloc(ROUNDS, sizeof(*cells));
+  TEST_ASSERT(cells != NULL, "cells alloc");
+  for (size_t i = 0; i < ROUNDS; ++i) {
+    cells[i].payload = i * 2654435761u;
+    cells[i].expect = i * 2654435761u;
+    atomic_init(&cells[i].bad, 0);
+    while (pool_submit(p, read_payload_job, &cells[i]) != 0) sched_yield();
+  }
+  pool_wait(p);
+  for (size_t i = 0; i < ROUNDS; ++i) {
+    TEST_ASSERT(!atomic_load_explicit(&cells[i].bad, memory_order_relaxed),
+      "job observed payload written before submit");
+  }
+
+  free(cells);
+  pool_destroy(p, 1);
+}
+
+// completed release (worker) -> completed acquire (pool_wait): data written
+// by a job is visible once pool_wait() returns.
+static void write_payload_job(void *arg) {
+  mp_cell_t *c = (mp_cell_t *)arg;
+  c->payload = c->expect;
+}
+
+static void test_wait_publishes_results(void) {
+  pool_t *p = pool_create(2, 64);
+  TEST_ASSERT(p != NULL, "pool create");
+
+  mp_cell_t cell;
+  for (size_t i = 1; i <= ROUNDS; ++i) {
+    cell.payload = 0;
+    cell.expect = i;
+    TEST_ASSERT(pool_submit(p, write_payload_job, &cell) == 0, "submit job");
+    pool_wait(p);
+    TEST_ASSERT(cell.payload == i, "pool_wait observed job result");
+  }
+
+  pool_destroy(p, 1);
+}
+
+// claim store -> dequeue CAS release -> dequeue_pos acquire, and active
+// release -> active acquire: the watermark never passes a job that is still
+// running, and its result is visible once it has.
+static void test_watermark_publishes_results(void) {
+  pool_t *p = pool_create(2, 64);
+  TEST_ASSERT(p != NULL, "pool create");
+
+  mp_cell_t cell;
+  for (size_t i = 1; i <= ROUNDS; ++i) {
+    pool_ticket_t t;
+    cell.payload = 0;
+    cell.expect = i;
+    TEST_ASSERT(pool_submit_ticket(p, write_payload_job, &cell, &t) == 0, "submit job");
+    pool_wait_until(p, t);
+    TEST_ASSERT(cell.payload == i, "pool_wait_until observed job result");
+  }
+
+  pool_destroy(p, 1);
+}
+
+// completed acquire loads before the relaxed enqueue_pos load: a waiter can
+// never count more completions than submissions.
+typedef struct {
+  pool_t *pool;
+  atomic_int stop;
+} observer_args_t;
+
+static void *observer_thread(void *arg) {
+  observer_args_t *oa = (observer_args_t *)arg;
+  while (!atomic_load_explicit(&oa->stop, memory_order_relaxed)) {
+    size_t done = pool_completed(oa->pool);
+    size_t submitted = pool_submitted(oa->pool);
+    TEST_ASSERT(done <= submitted, "completions never exceed submissions");
+  }
+  return NULL;
+}
+
+static void empty_job(void *arg) { (void)arg; }
+
+static void test_counts_never_cross(void) {
+  pool_t *p = pool_create(2, 64);
+  TEST_ASSERT(p != NULL, "pool create");
+
+  observer_args_t oa = { .pool = p };
+  atomic_init(&oa.stop, 0);
+  pthread_t observer;
+  pthread_create(&observer, NULL, observer_thread, &oa);
+
+  for (size_t i = 0; i < ROUNDS; ++i) {
+    while (pool_submit(p, empty_job, NULL) != 0) sched_yield();
+  }
+  pool_wait(p);
+  atomic_store_explicit(&oa.stop, 1, memory_order_relaxed);
+  pthread_join(observer, NULL);
+
+  pool_destroy(p, 1);
+}
+
+// Hand-off rounds are slower (each waits for the worker to settle), so they
+// run fewer of them. On one CPU there is no reordering to catch and spinning
+// workers only hold the submitter off the core, so a handful will do.
+#define HANDOFF_ROUNDS (mpmc_spin_cal.single_cpu ? 100 : 2000)
+
+// Round trip for the hand-off tests: the job reads `payload` and then writes
+// `expect` back into it, which the submitter checks after pool_wait().
+static void swap_payload_job(void *arg) {
+  mp_cell_t *c = (mp_cell_t *)arg;
+  if (c->payload != c->expect) atomic_store_explicit(&c->bad, 1, memory_order_relaxed);
+  c->payload = ~c->expect;
+}
+
+static size_t handed_total(pool_t *p) {
+  size_t n = 0;
+  for (size_t i = 0; i < p->n_threads; ++i)
+    n += atomic_load_explicit(&p->workers[i].xchg_handed, memory_order_relaxed);
+  return n;
+}
+
+// claim CAS acquire -> XCHG_FULL release -> state acquire (elimination): a
+// job handed to a spinning worker sees data written before the submit.
+static void test_exchange_publishes_job(void) {
+  pool_t *p = pool_create(1, 64);
+  TEST_ASSERT(p != NULL, "pool create");
+  pool_idle_policy_t spin = { .hot_workers = 1, .hot_ns = 1000000000u, .cold_ns = 0 };
+  TEST_ASSERT(pool_set_idle_policy(p, &spin) == 0, "set idle policy");
+
+  mp_cell_t cell;
+  atomic_init(&cell.bad, 0);
+  size_t handed = handed_total(p);
+  for (size_t i = 1; i <= HANDOFF_ROUNDS; ++i) {
+    while (atomic_load_explicit(&p->n_spinning, memory_order_relaxed) == 0) sched_yield();
+    cell.payload = cell.expect = i;
+    TEST_ASSERT(pool_submit(p, swap_payload_job, &cell) == 0, "submit job");
+    pool_wait(p);
+    TEST_ASSERT(cell.payload == ~i, "pool_wait observed handed job result");
+  }
+  TEST_ASSERT(!atomic_load_explicit(&cell.bad, memory_order_relaxed),
+    "spinning worker observed payload written before submit");
+  TEST_ASSERT(handed_total(p) > handed, "jobs went through the exchange slot");
+
+  pool_destroy(p, 1);
+}
+
+// mailbox write -> XCHG_FULL release -> state acquire after the semaphore
+// wakeup: a job handed to a parked worker sees data written before the
+// submit.
+static void test_mailbox_publishes_job(void) {
+  pool_t *p = pool_create(1, 64);
+  TEST_ASSERT(p != NULL, "pool create");
+  pool_idle_policy_t park = { .hot_workers = 0, .hot_ns = 0, .cold_ns = 0 };
+  TEST_ASSERT(pool_set_idle_policy(p, &park) == 0, "set idle policy");
+
+  mp_cell_t cell;
+  atomic_init(&cell.bad, 0);
+  size_t handed = handed_total(p);
+  for (size_t i = 1; i <= HANDOFF_ROUNDS; ++i) {
+    while (!(unsigned)atomic_load_explicit(&p->idle_head, memory_order_relaxed)) sched_yield();
+    cell.payload = cell.expect = i;
+    TEST_ASSERT(pool_submit(p, swap_payload_job, &cell) == 0, "submit job");
+    pool_wait(p);
+    TEST_ASSERT(cell.payload == ~i, "pool_wait observed mailbox job result");
+  }
+  TEST_ASSERT(!atomic_load_explicit(&cell.bad, memory_order_relaxed),
+    "parked worker observed payload written before submit");
+  TEST_ASSERT(handed_total(p) > handed, "jobs went through the mailbox");
+
+  pool_destroy(p, 1);
+}
+
+// request `state` release -> combiner acquire, and result `state` release ->
+// submitter acquire: with combining forced on, the job sees its argument and
+// the submitter sees the ticket the combiner wrote.
+typedef struct {
+  pool_t *pool;
+  mp_cell_t *cells;
+  size_t n;
+} fc_args_t;
+
+static void *fc_submitter(void *arg) {
+  fc_args_t *fa = (fc_args_t *)arg;
+  for (size_t i = 0; i < fa->n; ++i) {
+    mp_cell_t *c = &fa->cells[i];
+    c->payload = c->expect = i * 2654435761u;
+    atomic_store_explicit(&fa->pool->fc_enabled, 1, memory_order_relaxed);
+    pool_ticket_t t;
+    while (pool_submit_ticket(fa->pool, swap_payload_job, c, &t) != 0) sched_yield();
+    pool_wait_until(fa->pool, t);
+    TEST_ASSERT(c->payload == ~c->expect, "ticket from the combiner covers the job");
+  }
+  return NULL;
+}
+
+static void test_combiner_publishes_requests(void) {
+  pool_t *p = pool_create(2, 64);
+  TEST_ASSERT(p != NULL, "pool create");
+
+  enum { SUBMITTERS = 2 };
+  fc_args_t fa[SUBMITTERS];
+  pthread_t th[SUBMITTERS];
+  for (int t = 0; t < SUBMITTERS; ++t) {
+    fa[t].pool = p;
+    fa[t].n = HANDOFF_ROUNDS;
+    fa[t].cells = calloc(fa[t].n, sizeof(mp_cell_t));
+    TEST_ASSERT(fa[t].cells != NULL, "cells alloc");
+    pthread_create(&th[t], NULL, fc_submitter, &fa[t]);
+  }
+  for (int t = 0; t < SUBMITTERS; ++t) {
+    pthread_join(th[t], NULL);
+    for (size_t i = 0; i < fa[t].n; ++i) {
+      TEST_ASSERT(!atomic_load_explicit(&fa[t].cells[i].bad, memory_order_relaxed),
+        "combined job observed payload written before submit");
+    }
+    free(fa[t].cells);
+  }
+
+  pool_destroy(p, 1);
+}
+
+// local_tail seq_cst store -> local_tail acquire, found through the work
+// hint: a job pushed on a worker's own ring and taken by a spinning peer sees
+// data its parent wrote before the push.
+typedef struct {
+  pool_t *pool;
+  mp_cell_t cell;
+  atomic_int child_done;
+} hint_args_t;
+
+static void hint_child_job(void *arg) {
+  hint_args_t *ha = (hint_args_t *)arg;
+  swap_payload_job(&ha->cell);
+  atomic_store_explicit(&ha->child_done, 1, memory_order_release);
+}
+
+static void hint_parent_job(void *arg) {
+  hint_args_t *ha = (hint_args_t *)arg;
+  ha->cell.payload = ha->cell.expect;
+  TEST_ASSERT(pool_submit(ha->pool, hint_child_job, ha) == 0, "submit child");
+  // Leave the child to the peer.
+  while (!atomic_load_explicit(&ha->child_done, memory_order_acquire)) sched_yield();
+}
+
+static void test_hint_publishes_local_job(void) {
+  pool_t *p = pool_create(2, 64);
+  TEST_ASSERT(p != NULL, "pool create");
+  pool_idle_policy_t spin = { .hot_workers = 2, .hot_ns = 1000000000u, .cold_ns = 0 };
+  TEST_ASSERT(pool_set_idle_policy(p, &spin) == 0, "set idle policy");
+
+  hint_args_t ha = { .pool = p };
+  atomic_init(&ha.cell.bad, 0);
+  for (size_t i = 1; i <= HANDOFF_ROUNDS; ++i) {
+    ha.cell.expect = i;
+    atomic_store_explicit(&ha.child_done, 0, memory_order_relaxed);
+    TEST_ASSERT(pool_submit(p, hint_parent_job, &ha) == 0, "submit parent");
+    pool_wait(p);
+    TEST_ASSERT(ha.cell.payload == ~i, "pool_wait observed child result");
+  }
+  TEST_ASSERT(!atomic_load_explicit(&ha.cell.bad, memory_order_relaxed),
+    "peer observed payload written before the local push");
+
+  pool_destroy(p, 1);
+}
+
+// seq release -> seq acquire on the credit and class queues, and the credit
+// coming back only after the slot is freed: credited and class jobs see data
+// written before their submit, and a recycled credit never lands on a slot
+// still being read.
+static void test_credit_and_class_publish_jobs(void) {
+  pool_t *p = pool_create(2, 4);
+  TEST_ASSERT(p != NULL, "pool create");
+  TEST_ASSERT(pool_set_class_rate(p, 0, 0, 0) == 0, "set class rate");
+
+  mp_cell_t *cells = calloc(ROUNDS, sizeof(*cells));
+  TEST_ASSERT(cells != NULL, "cells alloc");
+  for (size_t i = 0; i < ROUNDS; ++i) {
+    cells[i].payload = cells[i].expect = i * 2654435761u;
+    atomic_init(&cells[i].bad, 0);
+    if (i & 1) {
+      while (pool_submit_class(p, 0, read_payload_job, &cells[i]) != 0) sched_yield();
+    } else {
+      TEST_ASSERT(pool_acquire_credits(p, 1, -1) == 0, "acquire credit");
+      pool_submit_credited(p, read_payload_job, &cells[i]);
+    }
+  }
+  pool_wait(p);
+  for (size_t i = 0; i < ROUNDS; ++i) {
+    TEST_ASSERT(!atomic_load_explicit(&cells[i].bad, memory_order_relaxed),
+      "credited or class job observed payload written before submit");
+  }
+
+  free(cells);
+  pool_destroy(p, 1);
+}
+
+int main(void) {
+  printf("Running memory ordering litmus tests ...\n");
+  test_submit_publishes_arg();
+  test_wait_publishes_results();
+  test_watermark_publishes_results();
+  test_counts_never_cross();
+  test_exchange_publishes_job();
+  test_mailbox_publishes_job();
+  test_combiner_publishes_requests();
+  test_hint_publishes_local_job();
+  test_credit_and_class_publish_jobs();
+  printf("OK: litmus tests passed\n");
+  return 0;
+}
@@ -15,6 +15,21 @@
   } \
 } while (0)
 
+// Blocking dequeue for the tests: the pool's workers only use
+// mpmc_dequeue_try() and park on their own semaphores. Before sleeping on
+// `available`, watches enqueue_pos for a short while.
+static int mpmc_dequeue_wait(mpmc_queue_t *q, job_t *out_job) {
+  if (mpmc_sem_trywait(&q->available) != 0) {
+    if (!mpmc_spin_cal.single_cpu) {
+      size_t tail = atomic_load_explicit(&q->enqueue_pos, memory_order_relaxed);
+      mpmc_spin_until_change(&q->enqueue_pos, tail, MPMC_IDLE_SPIN_NS);
+    }
+    if (mpmc_sem_trywait(&q->available) != 0 && mpmc_sem_wait(&q->available) != 0)
+      return -1;
+  }
+  return mpmc_dequeue_take(q, out_job, NULL);
+}
+
 static void dummy_job(void *arg) {
   (void)arg;
 }
@@ -53,6 +68,84 @@ static void test_basic_fifo_and_full(void) {
   mpmc_queue_destroy(q);
 }
 
+static void test_batch_enqueue(void) {
+  mpmc_queue_t *q = mpmc_queue_create(4);
+  TEST_ASSERT(q != NULL, "queue create");
+
+  job_t jobs[6];
+  for (size_t i = 0; i < 6; ++i) {
+    jobs[i].func = dummy_job;
+    jobs[i].arg = (void *)(uintptr_t)(i + 1);
+  }
+
+  size_t first = 99;
+  TEST_ASSERT(mpmc_enqueue_batch(q, jobs, 3, &first) == 3, "batch enqueued");
+  TEST_ASSERT(first == 0, "batch starts at head");
+  TEST_ASSERT(mpmc_enqueue_batch(q, jobs + 3, 3, &first) == 1, "batch clipped to free space");
+  TEST_ASSERT(first == 3, "second batch follows first");
+  TEST_ASSERT(mpmc_enqueue_batch(q, jobs, 1, &first) == 0, "full queue takes nothing");
+
+  for (size_t i = 0; i < 4; ++i) {
+    job_t out;
+    TEST_ASSERT(mpmc_dequeue_wait(q, &out) == 0, "dequeue ok");
+    TEST_ASSERT((size_t)(uintptr_t)out.arg == i + 1, "batch preserves fifo order");
+  }
+
+  // wrap around with batches
+  for (size_t round = 0; round < 1000; ++round) {
+    TEST_ASSERT(mpmc_enqueue_batch(q, jobs, 3, &first) == 3, "batch after wrap");
+    for (size_t i = 0; i < 3; ++i) {
+      job_t out;
+      TEST_ASSERT(mpmc_dequeue_wait(q, &out) == 0, "dequeue ok");
+      TEST_ASSERT((size_t)(uintptr_t)out.arg == i + 1, "wrapped batch order");
+    }
+  }
+
+  mpmc_queue_destroy(q);
+}
+
+// Direct enqueues and dequeues running next to a batch enqueue: the queue
+// never holds more than three jobs, so a batch must never find it full, even
+// when consumers move past the position it loaded.
+typedef struct {
+  mpmc_queue_t *q;
+  atomic_int stop;
+} churn_args_t;
+
+static void *churn_thread(void *arg) {
+  churn_args_t *ca = (churn_args_t *)arg;
+  job_t job = { .func = dummy_job, .arg = NULL }, out;
+  while (!atomic_load_explicit(&ca->stop, memory_order_relaxed)) {
+    if (mpmc_enqueue_nb(ca->q, job) == 0) {
+      while (mpmc_dequeue_try(ca->q, &out, NULL) != 0) sched_yield();
+    }
+  }
+  return NULL;
+}
+
+static void test_batch_enqueue_racing_consumers(void) {
+  mpmc_queue_t *q = mpmc_queue_create(4);
+  TEST_ASSERT(q != NULL, "queue create");
+
+  churn_args_t ca = { .q = q };
+  atomic_init(&ca.stop, 0);
+  pthread_t churn;
+  pthread_create(&churn, NULL, churn_thread, &ca);
+
+  job_t jobs[2] = { { .func = dummy_job }, { .func = dummy_job } }, out;
+  for (size_t i = 0; i < 100000; ++i) {
+    size_t first;
+    TEST_ASSERT(mpmc_enqueue_batch(q, jobs, 2, &first) == 2, "batch fits beside churn");
+    for (int j = 0; j < 2; ++j) {
+      while (mpmc_dequeue_try(q, &out, NULL) != 0) sched_yield();
+    }
+  }
+  atomic_store_explicit(&ca.stop, 1, memory_order_relaxed);
+  pthread_join(churn, NULL);
+
+  mpmc_queue_destroy(q);
+}
+
 static void test_wraparound_stability(void) {
   mpmc_queue_t *q = mpmc_queue_create(2);
   TEST_ASSERT(q != NULL, "queue create");
@@ -180,12 +273,69 @@ static void test_mpmc_concurrency(void) {
   mpmc_queue_destroy(q);
 }
 
+static void test_backoff_schedule(void) {
+  pool_backoff_t policy = {
+    .kind = POOL_BACKOFF_EXPONENTIAL, .min_ns = 100, .max_ns = 1000,
+    .spin_limit_ns = 0, .jitter = 0,
+  };
+  mpmc_backoff_t b;
+  mpmc_backoff_init(&b, &policy);
+  TEST_ASSERT(mpmc_backoff_next_ns(&b, 0) == 100, "exponential starts at min");
+  TEST_ASSERT(mpmc_backoff_next_ns(&b, 0) == 200, "exponential doubles");
+  for (int i = 0; i < 40; ++i) mpmc_backoff_next_ns(&b, 0);
+  TEST_ASSERT(mpmc_backoff_next_ns(&b, 0) == 1000, "exponential capped at max");
+
+  policy.kind = POOL_BACKOFF_FIXED;
+  mpmc_backoff_init(&b, &policy);
+  mpmc_backoff_next_ns(&b, 0);
+  TEST_ASSERT(mpmc_backoff_next_ns(&b, 0) == 100, "fixed stays at min");
+
+  policy.kind = POOL_BACKOFF_PROPORTIONAL;
+  mpmc_backoff_init(&b, &policy);
+  TEST_ASSERT(mpmc_backoff_next_ns(&b, 3) == 300, "proportional to distance");
+  TEST_ASSERT(mpmc_backoff_next_ns(&b, 50) == 1000, "proportional capped at max");
+
+  policy.kind = POOL_BACKOFF_FIXED;
+  policy.min_ns = 1000;
+  policy.jitter = 1;
+  mpmc_backoff_init(&b, &policy);
+  for (int i = 0; i < 1000; ++i) {
+    uint64_t ns = mpmc_backoff_next_ns(&b, 0);
+    TEST_ASSERT(ns >= 500 && ns <= 1000, "jitter within [wait/2, wait]");
+  }
+}
+
+// Reserved enqueues claim with a fetch_add and never check for room; as long
+// as the caller keeps within capacity they land in order on every lap.
+static void test_reserved_enqueue(void) {
+  mpmc_queue_t *q = mpmc_queue_create(4);
+  TEST_ASSERT(q != NULL, "queue create");
+  for (uintptr_t lap = 0; lap < 5; ++lap) {
+    for (uintptr_t i = 0; i < 4; ++i) {
+      job_t job = { .func = dummy_job, .arg = (void *)(lap * 4 + i) };
+      mpmc_enqueue_reserved(q, job);
+    }
+    job_t extra = { .func = dummy_job, .arg = NULL };
+    TEST_ASSERT(mpmc_enqueue_nb(q, extra) == -1, "reserved jobs fill the ring");
+    for (uintptr_t i = 0; i < 4; ++i) {
+      job_t out;
+      TEST_ASSERT(mpmc_dequeue_wait(q, &out) == 0, "dequeue ok");
+      TEST_ASSERT((uintptr_t)out.arg == lap * 4 + i, "fifo order");
+    }
+  }
+  mpmc_queue_destroy(q);
+}
+
 int main(void) {
   printf("Running mpmc queue tests ...\n");
   test_capacity_rounding();
   test_basic_fifo_and_full();
+  test_batch_enqueue();
+  test_batch_enqueue_racing_consumers();
+  test_reserved_enqueue();
   test_wraparound_stability();
   test_mpmc_concurrency();
+  test_backoff_schedule();
   printf("OK: mpmc queue tests passed\n");
   return 0;
 }
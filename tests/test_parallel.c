@@ -0,0 +1,317 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <stdatomic.h>
+
+// Include implementation to access internal APIs and types.
+#include "../thread_pool.c"
+#include "../pool_parallel.c"
+
+#define TEST_ASSERT(cond, msg) do { \
+  if (!(cond)) { \
+    fprintf(stderr, "FAIL: %s (%s:%d)\n", msg, __FILE__, __LINE__); \
+    exit(1); \
+  } \
+} while (0)
+
+static uint64_t rng_state = 88172645463325252ull;
+
+static uint64_t next_rand(void) {
+  rng_state ^= rng_state << 13;
+  rng_state ^= rng_state >> 7;
+  rng_state ^= rng_state << 17;
+  return rng_state;
+}
+
+typedef struct {
+  uint32_t key;
+  uint32_t id;
+  uint64_t payload;
+} record_t;
+
+static int cmp_record(const void *a, const void *b) {
+  const record_t *x = (const record_t *)a, *y = (const record_t *)b;
+  return (x->key > y->key) - (x->key < y->key);
+}
+
+static int cmp_int(const void *a, const void *b) {
+  int x = *(const int *)a, y = *(const int *)b;
+  return (x > y) - (x < y);
+}
+
+static void test_sort_records(void) {
+  pool_t *p = pool_create(4, 64);
+  TEST_ASSERT(p != NULL, "pool create");
+
+  static const size_t sizes[] = { 0, 1, 2, 17, 1000, 5000, 200000 };
+  for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); ++s) {
+    size_t n = sizes[s];
+    record_t *r = malloc((n ? n : 1) * sizeof(*r));
+    TEST_ASSERT(r != NULL, "records alloc");
+    uint64_t sum = 0;
+    for (size_t i = 0; i < n; ++i) {
+      r[i].key = (uint32_t)(next_rand() % 1000);  // plenty of duplicates
+      r[i].id = (uint32_t)i;
+      r[i].payload = (uint64_t)r[i].key * 31 + i;
+      sum += r[i].payload;
+    }
+    TEST_ASSERT(pool_parallel_sort(p, r, n, sizeof(*r), cmp_record) == 0, "sort");
+    uint64_t after = 0;
+    for (size_t i = 0; i < n; ++i) {
+      if (i) TEST_ASSERT(r[i - 1].key <= r[i].key, "records sorted");
+      TEST_ASSERT(r[i].payload == (uint64_t)r[i].key * 31 + r[i].id, "records intact");
+      after += r[i].payload;
+    }
+    TEST_ASSERT(after == sum, "records are a permutation");
+    free(r);
+  }
+
+  pool_destroy(p, 1);
+}
+
+static void test_sort_reversed_ints(void) {
+  pool_t *p = pool_create(2, 16);
+  TEST_ASSERT(p != NULL, "pool create");
+
+  const int n = 100000;
+  int *a = malloc(n * sizeof(*a));
+  TEST_ASSERT(a != NULL, "array alloc");
+  for (int i = 0; i < n; ++i) a[i] = n - i;
+  TEST_ASSERT(pool_parallel_sort(p, a, n, sizeof(*a), cmp_int) == 0, "sort");
+  for (int i = 0; i < n; ++i) TEST_ASSERT(a[i] == i + 1, "ints sorted");
+
+  free(a);
+  pool_destroy(p, 1);
+}
+
+// Sorting from inside a job: the sort's own spawns go on the worker's ring.
+typedef struct {
+  pool_t *pool;
+  int *a;
+  size_t n;
+} sort_job_args_t;
+
+static void sort_in_job(void *arg) {
+  sort_job_args_t *s = (sort_job_args_t *)arg;
+  TEST_ASSERT(pool_parallel_sort(s->pool, s->a, s->n, sizeof(int), cmp_int) == 0, "nested sort");
+}
+
+static void test_sort_inside_jobs(void) {
+  pool_t *p = pool_create(2, 16);
+  TEST_ASSERT(p != NULL, "pool create");
+
+  enum { jobs = 4, n = 50000 };
+  int *a = malloc(jobs * n * sizeof(*a));
+  TEST_ASSERT(a != NULL, "array alloc");
+  sort_job_args_t args[jobs];
+  for (size_t i = 0; i < (size_t)jobs * n; ++i) a[i] = (int)(next_rand() % 100000);
+  for (int j = 0; j < jobs; ++j) {
+    args[j].pool = p;
+    args[j].a = a + (size_t)j * n;
+    args[j].n = n;
+    TEST_ASSERT(pool_submit(p, sort_in_job, &args[j]) == 0, "submit sort job");
+  }
+  pool_wait(p);
+  for (int j = 0; j < jobs; ++j)
+    for (size_t i = 1; i < n; ++i)
+      TEST_ASSERT(args[j].a[i - 1] <= args[j].a[i], "each slice sorted");
+
+  free(a);
+  pool_destroy(p, 1);
+}
+
+static void check_u64(pool_t *p, uint64_t *k, size_t n) {
+  uint64_t sum = 0, x = 0;
+  for (size_t i = 0; i < n; ++i) { sum += k[i]; x ^= k[i] * 0x9e3779b97f4a7c15ull; }
+  TEST_ASSERT(pool_parallel_sort_u64(p, k, n) == 0, "radix sort");
+  uint64_t sum2 = 0, x2 = 0;
+  for (size_t i = 0; i < n; ++i) {
+    if (i) TEST_ASSERT(k[i - 1] <= k[i], "keys sorted");
+    sum2 += k[i];
+    x2 ^= k[i] * 0x9e3779b97f4a7c15ull;
+  }
+  TEST_ASSERT(sum == sum2 && x == x2, "keys are a permutation");
+}
+
+static void test_sort_u64(void) {
+  pool_t *p = pool_create(4, 64);
+  TEST_ASSERT(p != NULL, "pool create");
+
+  const size_t n = 300000;
+  uint64_t *k = malloc(n * sizeof(*k));
+  TEST_ASSERT(k != NULL, "keys alloc");
+
+  for (size_t i = 0; i < n; ++i) k[i] = next_rand();
+  check_u64(p, k, n);
+  for (size_t i = 0; i < n; ++i) k[i] = next_rand() & 0xffff;  // most digits skipped
+  check_u64(p, k, n);
+  for (size_t i = 0; i < n; ++i) k[i] = 42;                      // every digit skipped
+  check_u64(p, k, n);
+  for (size_t i = 0; i < 1000; ++i) k[i] = 1000 - i;             // single chunk
+  check_u64(p, k, 1000);
+  check_u64(p, k, 1);
+
+  free(k);
+  pool_destroy(p, 1);
+}
+
+static void check_mem(pool_t *p, size_t n, size_t dst_off, size_t src_off) {
+  unsigned char *src = malloc(n + src_off), *dst = malloc(n + dst_off + 1);
+  TEST_ASSERT(src && dst, "buffers alloc");
+  for (size_t i = 0; i < n; ++i) src[src_off + i] = (unsigned char)(i * 7 + (i >> 12));
+  dst[dst_off + n] = 0xa5;
+
+  TEST_ASSERT(pool_parallel_memcpy(p, dst + dst_off, src + src_off, n) == dst + dst_off, "memcpy returns dst");
+  TEST_ASSERT(memcmp(dst + dst_off, src + src_off, n) == 0, "memcpy copied every byte");
+  TEST_ASSERT(dst[dst_off + n] == 0xa5, "memcpy stays in bounds");
+
+  TEST_ASSERT(pool_parallel_memset(p, dst + dst_off, 0x3c, n) == dst + dst_off, "memset returns dst");
+  for (size_t i = 0; i < n; ++i) TEST_ASSERT(dst[dst_off + i] == 0x3c, "memset set every byte");
+  TEST_ASSERT(dst[dst_off + n] == 0xa5, "memset stays in bounds");
+
+  free(src);
+  free(dst);
+}
+
+static void test_parallel_memory_ops(void) {
+  pool_t *p = pool_create(4, 64);
+  TEST_ASSERT(p != NULL, "pool create");
+
+  check_mem(p, 1000, 1, 0);                      // inline
+  check_mem(p, 3 * 1024 * 1024 + 123, 5, 3);     // unaligned head, partial tail
+  check_mem(p, POOL_PARALLEL_NT_BYTES + 77, 9, 1); // non-temporal stores
+
+  pool_destroy(p, 1);
+}
+
+typedef struct {
+  atomic_size_t calls;
+  atomic_size_t misaligned;
+  atomic_size_t covered;
+} map_stats_t;
+
+static void map_stats_init(map_stats_t *st) {
+  atomic_init(&st->calls, 0);
+  atomic_init(&st->misaligned, 0);
+  atomic_init(&st->covered, 0);
+}
+
+static void map_stats_add(map_stats_t *st, void *out, size_t count) {
+  atomic_fetch_add(&st->calls, 1);
+  if ((uintptr_t)out % 64 != 0) atomic_fetch_add(&st->misaligned, 1);
+  atomic_fetch_add(&st->covered, count);
+}
+
+static void square_kernel(const void *in, void *out, size_t count, void *arg) {
+  const float *x = (const float *)in;
+  float *y = (float *)out;
+  for (size_t i = 0; i < count; ++i) y[i] = x[i] * x[i];
+  map_stats_add((map_stats_t *)arg, out, count);
+}
+
+typedef struct {
+  float v[3];
+} vec3_t;
+
+static void scale_kernel(const void *in, void *out, size_t count, void *arg) {
+  const vec3_t *x = (const vec3_t *)in;
+  vec3_t *y = (vec3_t *)out;
+  for (size_t i = 0; i < count; ++i)
+    for (int k = 0; k < 3; ++k) y[i].v[k] = 2.0f * x[i].v[k];
+  map_stats_add((map_stats_t *)arg, out, count);
+}
+
+static void test_parallel_map(void) {
+  pool_t *p = pool_create(4, 64);
+  TEST_ASSERT(p != NULL, "pool create");
+
+  const size_t n = 1000003;
+  float *in = malloc(n * sizeof(float)), *buf = malloc((n + 16) * sizeof(float));
+  TEST_ASSERT(in && buf, "arrays alloc");
+  for (size_t i = 0; i < n; ++i) in[i] = (float)(i % 1000);
+
+  // Offsets put the first line edge at various element indices.
+  for (size_t off = 0; off < 16; off += 5) {
+    float *out = buf + off;
+    map_stats_t st;
+    map_stats_init(&st);
+    pool_parallel_map(p, in, out, n, sizeof(float), square_kernel, &st);
+    TEST_ASSERT(atomic_load(&st.covered) == n, "every element mapped once");
+    TEST_ASSERT(atomic_load(&st.calls) > 1, "work was split");
+    TEST_ASSERT(atomic_load(&st.misaligned) <= 1, "only the head chunk is misaligned");
+    for (size_t i = 0; i < n; ++i) TEST_ASSERT(out[i] == in[i] * in[i], "mapped values");
+  }
+
+  // 12-byte elements: edges every 16 elements (3 lines), in place.
+  const size_t nv = 100001;
+  vec3_t *v = malloc(nv * sizeof(*v));
+  TEST_ASSERT(v != NULL, "vec alloc");
+  for (size_t i = 0; i < nv; ++i) v[i].v[0] = v[i].v[1] = v[i].v[2] = (float)(i % 100);
+  map_stats_t st;
+  map_stats_init(&st);
+  pool_parallel_map(p, v, v, nv, sizeof(*v), scale_kernel, &st);
+  TEST_ASSERT(atomic_load(&st.covered) == nv, "every vec mapped once");
+  TEST_ASSERT(atomic_load(&st.misaligned) <= 1, "vec chunks aligned");
+  for (size_t i = 0; i < nv; ++i) TEST_ASSERT(v[i].v[2] == 2.0f * (float)(i % 100), "in-place map");
+
+  free(v);
+  free(in);
+  free(buf);
+  pool_destroy(p, 1);
+}
+
+// Terms spanning many magnitudes, so the sum depends on combine order.
+static double term(size_t i) {
+  double x = (double)((i * 2654435761u) % 1000003);
+  return (i % 3 == 0 ? 1e12 : 1e-3) * x * (i % 2 ? -1.0 : 1.0);
+}
+
+static void sum_leaf(size_t begin, size_t end, void *acc, void *arg) {
+  (void)arg;
+  double s = 0;
+  for (size_t i = begin; i < end; ++i) s += term(i);
+  *(double *)acc = s;
+}
+
+static void sum_combine(void *left, const void *right, void *arg) {
+  (void)arg;
+  *(double *)left += *(const double *)right;
+}
+
+static void test_deterministic_reduce(void) {
+  const size_t n = 1000000, grain = 1000;
+  double first = 0;
+  static const size_t workers[] = { 1, 2, 3, 4 };
+  for (size_t w = 0; w < sizeof(workers) / sizeof(workers[0]); ++w) {
+    pool_t *p = pool_create(workers[w], 64);
+    TEST_ASSERT(p != NULL, "pool create");
+    for (int run = 0; run < 5; ++run) {
+      double sum;
+      TEST_ASSERT(pool_parallel_reduce(p, n, grain, sizeof(sum), sum_leaf, sum_combine,
+                                       &sum, NULL) == 0, "reduce");
+      if (w == 0 && run == 0) first = sum;
+      TEST_ASSERT(memcmp(&sum, &first, sizeof(sum)) == 0, "bitwise identical across runs and pools");
+    }
+    double small;
+    TEST_ASSERT(pool_parallel_reduce(p, 10, grain, sizeof(small), sum_leaf, sum_combine,
+                                     &small, NULL) == 0, "small reduce");
+    double expect;
+    sum_leaf(0, 10, &expect, NULL);
+    TEST_ASSERT(small == expect, "single block reduce");
+    pool_destroy(p, 1);
+  }
+}
+
+int main(void) {
+  printf("Running parallel algorithm tests ...\n");
+  test_sort_records();
+  test_sort_reversed_ints();
+  test_sort_inside_jobs();
+  test_sort_u64();
+  test_parallel_memory_ops();
+  test_parallel_map();
+  test_deterministic_reduce();
+  printf("OK: parallel tests passed\n");
+  return 0;
+}
@@ -4,6 +4,8 @@
 #include <pthread.h>
 #include <stdatomic.h>
 #include <unistd.h>
+#include <sched.h>
+#include <sys/resource.h>
 
 // Include implementation to access internal APIs and types.
 #include "../thread_pool.c"
@@ -52,7 +54,7 @@ static void test_single_job(void) {
 }
 
 static void test_multiple_jobs(void) {
-  pool_t *p = pool_create(4, 32);
+  pool_t *p = pool_create(4, 128);
   TEST_ASSERT(p != NULL, "pool create");
 
   atomic_int counter;
@@ -118,6 +120,37 @@ static void test_submit_blocking(void) {
   pool_destroy(p, 1);
 }
 
+static void test_backoff_policies(void) {
+  pool_t *p = pool_create(1, 2);
+  TEST_ASSERT(p != NULL, "pool create");
+
+  pool_backoff_t bad = { .kind = POOL_BACKOFF_FIXED, .min_ns = 100, .max_ns = 10 };
+  TEST_ASSERT(pool_set_backoff(p, &bad) == -1, "max below min rejected");
+  bad.min_ns = 0;
+  TEST_ASSERT(pool_set_backoff(p, &bad) == -1, "zero min rejected");
+
+  static const pool_backoff_kind_t kinds[] = {
+    POOL_BACKOFF_EXPONENTIAL, POOL_BACKOFF_FIXED, POOL_BACKOFF_PROPORTIONAL,
+  };
+  atomic_int counter;
+  atomic_init(&counter, 0);
+  for (size_t k = 0; k < 3; ++k) {
+    pool_backoff_t policy = {
+      .kind = kinds[k], .min_ns = 50, .max_ns = 5000,
+      .spin_limit_ns = 20000, .jitter = (int)(k & 1),
+    };
+    TEST_ASSERT(pool_set_backoff(p, &policy) == 0, "set backoff");
+    for (int i = 0; i < 50; ++i) {
+      TEST_ASSERT(pool_submit_blocking(p, increment_job, &counter) == 0, "blocking submit");
+    }
+    pool_wait(p);
+  }
+  TEST_ASSERT(atomic_load_explicit(&counter, memory_order_relaxed) == 150,
+    "all jobs executed under every policy");
+
+  pool_destroy(p, 1);
+}
+
 static void test_concurrent_submits(void) {
   pool_t *p = pool_create(4, 256);
   TEST_ASSERT(p != NULL, "pool create");
@@ -185,6 +218,768 @@ static void test_concurrent_producers(void) {
   pool_destroy(p, 1);
 }
 
+// Regression for the old submit/queued race: the job count was bumped only
+// after the job was published, so a fast worker could decrement it first and
+// pool_wait() in another thread could return while that thread's own jobs
+// were still running. Each waiter checks that every job it submitted before
+// calling pool_wait() has finished.
+typedef struct {
+  pool_t *pool;
+  int rounds;
+  int per_round;
+  atomic_int done;
+} waiter_args_t;
+
+static void *submit_and_wait_thread(void *arg) {
+  waiter_args_t *wa = (waiter_args_t *)arg;
+  for (int r = 0; r < wa->rounds; ++r) {
+    for (int i = 0; i < wa->per_round; ++i) {
+      while (pool_submit(wa->pool, increment_job, &wa->done) != 0) sched_yield();
+    }
+    pool_wait(wa->pool);
+    int done = atomic_load_explicit(&wa->done, memory_order_relaxed);
+    TEST_ASSERT(done == (r + 1) * wa->per_round, "pool_wait covers own jobs");
+  }
+  return NULL;
+}
+
+static void test_wait_race_stress(void) {
+  pool_t *p = pool_create(4, 64);
+  TEST_ASSERT(p != NULL, "pool create");
+
+  enum { num_waiters = 4 };
+  pthread_t threads[num_waiters];
+  waiter_args_t args[num_waiters];
+  for (int i = 0; i < num_waiters; ++i) {
+    args[i].pool = p;
+    args[i].rounds = 200;
+    args[i].per_round = 8;
+    atomic_init(&args[i].done, 0);
+    pthread_create(&threads[i], NULL, submit_and_wait_thread, &args[i]);
+  }
+  for (int i = 0; i < num_waiters; ++i) {
+    pthread_join(threads[i], NULL);
+  }
+
+  pool_destroy(p, 1);
+}
+
+typedef struct {
+  pool_t *pool;
+  atomic_int *counter;
+} nested_args_t;
+
+static void spawn_child_job(void *arg) {
+  nested_args_t *na = (nested_args_t *)arg;
+  usleep(100);
+  TEST_ASSERT(pool_submit(na->pool, increment_job, na->counter) == 0, "nested submit");
+}
+
+static void test_wait_covers_nested_jobs(void) {
+  pool_t *p = pool_create(2, 64);
+  TEST_ASSERT(p != NULL, "pool create");
+
+  atomic_int counter;
+  atomic_init(&counter, 0);
+  nested_args_t na = { .pool = p, .counter = &counter };
+
+  for (int i = 0; i < 16; ++i) {
+    TEST_ASSERT(pool_submit(p, spawn_child_job, &na) == 0, "submit parent");
+  }
+  pool_wait(p);
+  TEST_ASSERT(atomic_load_explicit(&counter, memory_order_relaxed) == 16,
+    "pool_wait covers jobs spawned by jobs");
+
+  pool_destroy(p, 1);
+}
+
+// Recursive fork/join: each level spawns one half and runs the other inline,
+// so far more frames wait in pool_sync() than there are workers.
+typedef struct {
+  pool_t *pool;
+  int n;
+  long result;
+} fib_args_t;
+
+static void fib_job(void *arg) {
+  fib_args_t *fa = (fib_args_t *)arg;
+  if (fa->n < 2) {
+    fa->result = fa->n;
+    return;
+  }
+  fib_args_t left = { fa->pool, fa->n - 1, 0 }, right = { fa->pool, fa->n - 2, 0 };
+  pool_frame_t frame;
+  pool_task_t task;
+  pool_frame_init(&frame, fa->pool);
+  pool_spawn(&frame, &task, fib_job, &left);
+  fib_job(&right);
+  pool_sync(&frame);
+  fa->result = left.result + right.result;
+}
+
+static void test_spawn_sync(void) {
+  pool_t *p = pool_create(2, 16);
+  TEST_ASSERT(p != NULL, "pool create");
+
+  fib_args_t fa = { p, 20, 0 };
+  pool_frame_t frame;
+  pool_task_t task;
+  pool_frame_init(&frame, p);
+  pool_spawn(&frame, &task, fib_job, &fa);
+  pool_sync(&frame);
+  TEST_ASSERT(fa.result == 6765, "fib(20) via spawn/sync");
+
+  pool_wait(p);
+  pool_destroy(p, 1);
+}
+
+static void gate_job(void *arg) {
+  atomic_int *gate = (atomic_int *)arg;
+  while (!atomic_load_explicit(gate, memory_order_acquire)) usleep(100);
+}
+
+static void test_wait_until_ticket(void) {
+  pool_t *p = pool_create(2, 64);
+  TEST_ASSERT(p != NULL, "pool create");
+
+  atomic_int counter, gate;
+  atomic_init(&counter, 0);
+  atomic_init(&gate, 0);
+
+  pool_ticket_t prev = 0, ticket = 0;
+  for (int i = 0; i < 10; ++i) {
+    TEST_ASSERT(pool_submit_ticket(p, increment_job, &counter, &ticket) == 0, "submit job");
+    TEST_ASSERT(i == 0 || ticket > prev, "tickets increase");
+    prev = ticket;
+  }
+
+  // A job submitted after the ticket must not hold up pool_wait_until().
+  TEST_ASSERT(pool_submit(p, gate_job, &gate) == 0, "submit gate");
+  pool_wait_until(p, ticket);
+  TEST_ASSERT(atomic_load_explicit(&counter, memory_order_relaxed) == 10,
+    "jobs up to ticket executed");
+
+  atomic_store_explicit(&gate, 1, memory_order_release);
+  pool_wait(p);
+  pool_destroy(p, 1);
+}
+
+typedef struct {
+  pool_t *pool;
+  atomic_int *seen;
+  int base;
+  int count;
+  pool_ticket_t *tickets;
+} combining_args_t;
+
+static void mark_seen_job(void *arg) {
+  atomic_fetch_add_explicit((atomic_int *)arg, 1, memory_order_relaxed);
+}
+
+static void *combining_producer(void *arg) {
+  combining_args_t *ca = (combining_args_t *)arg;
+  for (int i = 0; i < ca->count; ++i) {
+    pool_ticket_t t;
+    while (pool_submit_ticket(ca->pool, mark_seen_job, &ca->seen[ca->base + i], &t) != 0)
+      sched_yield();
+    ca->tickets[ca->base + i] = t;
+  }
+  return NULL;
+}
+
+static void test_flat_combining_submit(void) {
+  pool_t *p = pool_create(2, 64);
+  TEST_ASSERT(p != NULL, "pool create");
+  // Force the combining path regardless of how contended this machine gets.
+  atomic_store(&p->fc_enabled, 1);
+  atomic_store(&p->fc_heat, FC_HEAT_MAX);
+
+  enum { producers = 4, per_producer = 500, total = producers * per_producer };
+  atomic_int *seen = calloc(total, sizeof(*seen));
+  pool_ticket_t *tickets = calloc(total, sizeof(*tickets));
+  TEST_ASSERT(seen && tickets, "alloc");
+
+  pthread_t threads[producers];
+  combining_args_t args[producers];
+  for (int i = 0; i < producers; ++i) {
+    args[i] = (combining_args_t){ p, seen, i * per_producer, per_producer, tickets };
+    pthread_create(&threads[i], NULL, combining_producer, &args[i]);
+  }
+  for (int i = 0; i < producers; ++i) pthread_join(threads[i], NULL);
+  pool_wait(p);
+
+  char *used = calloc(total, 1);
+  TEST_ASSERT(used != NULL, "alloc");
+  for (int i = 0; i < total; ++i) {
+    TEST_ASSERT(atomic_load(&seen[i]) == 1, "combined job ran exactly once");
+    TEST_ASSERT(tickets[i] < total && !used[tickets[i]], "tickets are unique");
+    used[tickets[i]] = 1;
+  }
+
+  free(used);
+  free(tickets);
+  free(seen);
+  pool_destroy(p, 1);
+}
+
+// A job that spawns children and then waits for them: the children sit on
+// its worker's own ring, so they only finish if peers take them from there.
+enum { local_children = 8 };
+
+static void spawn_and_wait_job(void *arg) {
+  nested_args_t *na = (nested_args_t *)arg;
+  for (int i = 0; i < local_children; ++i)
+    TEST_ASSERT(pool_submit(na->pool, increment_job, na->counter) == 0, "nested submit");
+  while (atomic_load_explicit(na->counter, memory_order_relaxed) < local_children) sched_yield();
+}
+
+static void test_local_ring_submit(void) {
+  pool_t *p = pool_create(4, 16);
+  TEST_ASSERT(p != NULL, "pool create");
+
+  atomic_int counter;
+  atomic_init(&counter, 0);
+  nested_args_t na = { p, &counter };
+  TEST_ASSERT(pool_submit(p, spawn_and_wait_job, &na) == 0, "submit parent");
+  pool_wait(p);
+  TEST_ASSERT(atomic_load_explicit(&counter, memory_order_relaxed) == local_children,
+    "children executed");
+
+  size_t local = 0;
+  for (size_t i = 0; i < p->n_threads; ++i) local += atomic_load(&p->workers[i].local_pushed);
+  TEST_ASSERT(local == local_children, "children went through the local ring");
+  TEST_ASSERT(atomic_load(&p->q->enqueue_pos) <= 1, "only the parent used the global ring");
+
+  pool_destroy(p, 1);
+}
+
+static void test_cache_topology(void) {
+  pool_topo_t t;
+  if (pool_topo_load(&t) == 0) {
+    TEST_ASSERT(t.n_cpus >= 1, "at least one CPU");
+    for (int c = 0; c < t.n_cpus; ++c) {
+      TEST_ASSERT(pool_topo_distance(&t, c, c) == POOL_TOPO_SMT, "CPU is nearest to itself");
+      TEST_ASSERT(pool_topo_distance(&t, c, 0) == pool_topo_distance(&t, 0, c), "distance is symmetric");
+    }
+  }
+  TEST_ASSERT(pool_topo_distance(&t, -1, 0) == POOL_TOPO_LLC, "unknown CPU shares the LLC");
+  pool_topo_free(&t);
+}
+
+static void record_job(void *arg) { (void)arg; }
+
+// local_steal() moves half of the victim's jobs, oldest first, in one claim.
+static void test_steal_half(void) {
+  worker_t *w = aligned_alloc(CACHE_LINE, 2 * sizeof(worker_t));
+  TEST_ASSERT(w != NULL, "workers alloc");
+  memset(w, 0, 2 * sizeof(worker_t));
+  worker_t *victim = &w[0], *thief = &w[1];
+  pool_t stub;  // only work_hint is touched
+  memset(&stub, 0, sizeof(stub));
+  victim->pool = thief->pool = &stub;
+
+  for (uintptr_t i = 0; i < 10; ++i) {
+    job_t job = { record_job, (void *)i };
+    TEST_ASSERT(local_push(victim, job) == 0, "push");
+  }
+  job_t out;
+  TEST_ASSERT(local_steal(victim, thief, POOL_TOPO_SMT, &out) == 5, "took half");
+  TEST_ASSERT((uintptr_t)out.arg == 0, "oldest job returned");
+  for (uintptr_t i = 1; i < 5; ++i) {
+    TEST_ASSERT(local_take(thief, &out) == 0 && (uintptr_t)out.arg == i, "rest queued in order");
+  }
+  TEST_ASSERT(local_take(thief, &out) != 0, "thief ring drained");
+  TEST_ASSERT(atomic_load(&thief->local_pushed) == 0, "steals are not submissions");
+
+  // Far victims give at least STEAL_BATCH(level) jobs.
+  TEST_ASSERT(local_steal(victim, thief, POOL_TOPO_REMOTE, &out) == 5, "took the rest");
+  TEST_ASSERT((uintptr_t)out.arg == 5, "victim order kept");
+  TEST_ASSERT(local_steal(victim, thief, POOL_TOPO_REMOTE, &out) == 0, "victim empty");
+
+  free(w);
+}
+
+static void test_elimination_handoff(void) {
+  pool_t *p = pool_create(2, 16);
+  TEST_ASSERT(p != NULL, "pool create");
+  // Keep idle workers spinning long enough to be found, even on one CPU.
+  pool_idle_policy_t spin = { .cold_ns = 5000000 };
+  TEST_ASSERT(pool_set_idle_policy(p, &spin) == 0, "set idle policy");
+
+  atomic_int counter;
+  atomic_init(&counter, 0);
+  const int num_jobs = 50;
+  for (int i = 0; i < num_jobs; ++i) {
+    usleep(200);  // let the workers go idle and offer their slots
+    TEST_ASSERT(pool_submit(p, increment_job, &counter) == 0, "submit job");
+  }
+  pool_wait(p);
+  TEST_ASSERT(atomic_load_explicit(&counter, memory_order_relaxed) == num_jobs,
+    "all jobs executed");
+
+  size_t handed = 0;
+  for (size_t i = 0; i < p->n_threads; ++i) handed += atomic_load(&p->workers[i].xchg_handed);
+  TEST_ASSERT(handed > 0, "some jobs bypassed the ring");
+  TEST_ASSERT(handed + atomic_load(&p->q->enqueue_pos) == (size_t)num_jobs,
+    "every job counted exactly once");
+
+  pool_idle_policy_t park = { .cold_ns = 0 };
+  pool_set_idle_policy(p, &park);
+  pool_destroy(p, 1);
+}
+
+static void test_parked_handoff(void) {
+  pool_t *p = pool_create(2, 16);
+  TEST_ASSERT(p != NULL, "pool create");
+  // No idle spinning: workers park straight away and take jobs by mailbox.
+  pool_idle_policy_t park = { .cold_ns = 0 };
+  pool_set_idle_policy(p, &park);
+
+  atomic_int counter;
+  atomic_init(&counter, 0);
+  const int num_jobs = 50;
+  for (int i = 0; i < num_jobs; ++i) {
+    usleep(200);  // let the workers park
+    TEST_ASSERT(pool_submit(p, increment_job, &counter) == 0, "submit job");
+  }
+  pool_wait(p);
+  TEST_ASSERT(atomic_load_explicit(&counter, memory_order_relaxed) == num_jobs,
+    "all jobs executed");
+
+  size_t handed = 0;
+  for (size_t i = 0; i < p->n_threads; ++i) handed += atomic_load(&p->workers[i].xchg_handed);
+  TEST_ASSERT(handed > 0, "some jobs were handed to parked workers");
+  TEST_ASSERT(handed + atomic_load(&p->q->enqueue_pos) == (size_t)num_jobs,
+    "every job counted exactly once");
+
+  pool_destroy(p, 1);
+}
+
+// Serial light load on a pool with parked workers: LIFO wakeups keep
+// reusing the worker that went idle last instead of cycling through all.
+static void test_lifo_wake_order(void) {
+  pool_t *p = pool_create(4, 16);
+  TEST_ASSERT(p != NULL, "pool create");
+  pool_idle_policy_t park = { .cold_ns = 0 };
+  pool_set_idle_policy(p, &park);
+  usleep(10000);  // let every worker park
+
+  atomic_int counter;
+  atomic_init(&counter, 0);
+  const int num_jobs = 50;
+  for (int i = 0; i < num_jobs; ++i) {
+    TEST_ASSERT(pool_submit(p, increment_job, &counter) == 0, "submit job");
+    pool_wait(p);
+    usleep(200);  // let the worker park again
+  }
+  TEST_ASSERT(atomic_load_explicit(&counter, memory_order_relaxed) == num_jobs,
+    "all jobs executed");
+
+  size_t used = 0;
+  for (size_t i = 0; i < p->n_threads; ++i) used += atomic_load(&p->workers[i].completed) > 0;
+  TEST_ASSERT(used <= 2, "light load stays on few workers");
+
+  pool_destroy(p, 1);
+}
+
+// One hot worker polls while the others park: a trickle of jobs is taken by
+// the hot worker straight from the submitter.
+static void test_hot_worker_policy(void) {
+  pool_t *p = pool_create(4, 16);
+  TEST_ASSERT(p != NULL, "pool create");
+  TEST_ASSERT(pool_set_idle_policy(p, NULL) == -1, "NULL policy rejected");
+  pool_idle_policy_t hot = { .hot_workers = 1, .hot_ns = 5000000, .cold_ns = 0 };
+  TEST_ASSERT(pool_set_idle_policy(p, &hot) == 0, "set idle policy");
+  usleep(1000);
+
+  atomic_int counter;
+  atomic_init(&counter, 0);
+  const int num_jobs = 50;
+  for (int i = 0; i < num_jobs; ++i) {
+    usleep(200);
+    TEST_ASSERT(pool_submit(p, increment_job, &counter) == 0, "submit job");
+  }
+  pool_wait(p);
+  TEST_ASSERT(atomic_load_explicit(&counter, memory_order_relaxed) == num_jobs,
+    "all jobs executed");
+  TEST_ASSERT(atomic_load(&p->workers[0].xchg_handed) > (size_t)num_jobs / 2,
+    "hot worker took most jobs");
+
+  pool_idle_policy_t park = { .cold_ns = 0 };
+  pool_set_idle_policy(p, &park);
+  pool_destroy(p, 1);
+}
+
+// A hot worker that sees a ticketed job land on the ring goes straight back
+// for it instead of parking and waking itself: the idle stack, whose tag
+// counts every push and pop, stays still.
+static void test_hot_worker_skips_idle_stack(void) {
+  pool_t *p = pool_create(1, 16);
+  TEST_ASSERT(p != NULL, "pool create");
+  pool_idle_policy_t hot = { .hot_workers = 1, .hot_ns = 2000000000u, .cold_ns = 0 };
+  TEST_ASSERT(pool_set_idle_policy(p, &hot) == 0, "set idle policy");
+
+  atomic_int counter;
+  atomic_init(&counter, 0);
+  const int num_jobs = 100;
+  while (atomic_load_explicit(&p->n_spinning, memory_order_relaxed) == 0) sched_yield();
+  unsigned long long tag = atomic_load(&p->idle_head) >> 32;
+  for (int i = 0; i < num_jobs; ++i) {
+    pool_ticket_t t;
+    TEST_ASSERT(pool_submit_ticket(p, increment_job, &counter, &t) == 0, "submit job");
+    pool_wait_until(p, t);
+  }
+  unsigned long long ops = (atomic_load(&p->idle_head) >> 32) - tag;
+  TEST_ASSERT(atomic_load_explicit(&counter, memory_order_relaxed) == num_jobs,
+    "all jobs executed");
+  TEST_ASSERT(ops <= 4, "hot worker did not go through the idle stack");
+
+  pool_idle_policy_t park = { .cold_ns = 0 };
+  pool_set_idle_policy(p, &park);
+  pool_destroy(p, 1);
+}
+
+static uint64_t process_cpu_ns(void) {
+  struct rusage ru;
+  getrusage(RUSAGE_SELF, &ru);
+  return ((uint64_t)ru.ru_utime.tv_sec + (uint64_t)ru.ru_stime.tv_sec) * 1000000000u +
+         ((uint64_t)ru.ru_utime.tv_usec + (uint64_t)ru.ru_stime.tv_usec) * 1000u;
+}
+
+// Plain (non-atomic) generator state: pool_run_stream() must never call it
+// concurrently.
+typedef struct {
+  size_t next, total;
+  unsigned char *seen;
+} stream_gen_t;
+
+static void stream_mark_job(void *arg) {
+  unsigned char *slot = (unsigned char *)arg;
+  ++*slot;
+}
+
+static int stream_next(void *ctx, job_t *job) {
+  stream_gen_t *g = (stream_gen_t *)ctx;
+  if (g->next == g->total) return -1;
+  job->func = stream_mark_job;
+  job->arg = &g->seen[g->next++];
+  return 0;
+}
+
+static void test_run_stream(void) {
+  pool_t *p = pool_create(4, 16);
+  TEST_ASSERT(p != NULL, "pool create");
+
+  stream_gen_t g = { 0, 100000, NULL };
+  g.seen = calloc(g.total, 1);
+  TEST_ASSERT(g.seen != NULL, "seen alloc");
+  size_t ring_before = atomic_load(&p->q->enqueue_pos);
+  TEST_ASSERT(pool_run_stream(p, stream_next, &g) == 0, "run stream");
+  for (size_t i = 0; i < g.total; ++i) TEST_ASSERT(g.seen[i] == 1, "every job ran exactly once");
+  TEST_ASSERT(atomic_load(&p->q->enqueue_pos) - ring_before <= p->n_threads,
+    "only the pumps went through the ring");
+
+  // An empty stream returns at once.
+  g.next = g.total;
+  TEST_ASSERT(pool_run_stream(p, stream_next, &g) == 0, "empty stream");
+
+  free(g.seen);
+  pool_destroy(p, 1);
+}
+
+// A generator that blocks, like one reading a file: the workers waiting for
+// their turn must sleep, so the process uses little CPU while it runs.
+static int stream_next_slow(void *ctx, job_t *job) {
+  usleep(2000);
+  return stream_next(ctx, job);
+}
+
+static void test_run_stream_blocking_generator(void) {
+  pool_t *p = pool_create(4, 16);
+  TEST_ASSERT(p != NULL, "pool create");
+
+  stream_gen_t g = { 0, 100, NULL };
+  g.seen = calloc(g.total, 1);
+  TEST_ASSERT(g.seen != NULL, "seen alloc");
+  uint64_t cpu0 = process_cpu_ns(), t0 = mpmc_spin_clock_ns();
+  TEST_ASSERT(pool_run_stream(p, stream_next_slow, &g) == 0, "run stream");
+  uint64_t cpu = process_cpu_ns() - cpu0, wall = mpmc_spin_clock_ns() - t0;
+  for (size_t i = 0; i < g.total; ++i) TEST_ASSERT(g.seen[i] == 1, "every job ran exactly once");
+  TEST_ASSERT(cpu < wall / 4, "waiting pumps sleep while the generator blocks");
+
+  free(g.seen);
+  pool_destroy(p, 1);
+}
+
+// Keeps the global ring busy: resubmits itself with a ticket, which always
+// goes through the global ring, until told to stop.
+typedef struct {
+  pool_t *pool;
+  atomic_int stop;
+} churn_t;
+
+static void churn_job(void *arg) {
+  churn_t *c = (churn_t *)arg;
+  pool_ticket_t t;
+  // The ring may look full for a moment while a preempted worker still holds
+  // a slot it dequeued from.
+  while (!atomic_load_explicit(&c->stop, memory_order_relaxed) &&
+         pool_submit_ticket(c->pool, churn_job, c, &t) != 0)
+    sched_yield();
+}
+
+static void churn_start(churn_t *c, pool_t *p, int jobs) {
+  c->pool = p;
+  atomic_init(&c->stop, 0);
+  for (int i = 0; i < jobs; ++i) {
+    pool_ticket_t t;
+    TEST_ASSERT(pool_submit_ticket(p, churn_job, c, &t) == 0, "submit churn job");
+  }
+}
+
+// Wait up to a second for `*flag` to be set.
+static int wait_flag(atomic_int *flag) {
+  uint64_t t0 = mpmc_spin_clock_ns();
+  while (!atomic_load_explicit(flag, memory_order_acquire)) {
+    if (mpmc_spin_clock_ns() - t0 > 1000000000u) return 0;
+    usleep(1000);
+  }
+  return 1;
+}
+
+static void set_flag_job(void *arg) {
+  atomic_store_explicit((atomic_int *)arg, 1, memory_order_release);
+}
+
+// A credited job still runs, and returns its credit, while the global ring
+// never runs dry.
+static void test_credits_under_busy_ring(void) {
+  pool_t *p = pool_create(2, 64);
+  TEST_ASSERT(p != NULL, "pool create");
+
+  churn_t churn;
+  churn_start(&churn, p, 8);
+  atomic_int ran;
+  atomic_init(&ran, 0);
+  TEST_ASSERT(pool_acquire_credits(p, 1, 0) == 0, "credit available");
+  pool_submit_credited(p, set_flag_job, &ran);
+  int in_time = wait_flag(&ran);
+  atomic_store_explicit(&churn.stop, 1, memory_order_relaxed);
+  pool_wait(p);
+  TEST_ASSERT(in_time, "credited job runs while the global ring is busy");
+
+  pool_destroy(p, 1);
+}
+
+static void *credit_waiter(void *arg) {
+  return (void *)(intptr_t)pool_acquire_credits((pool_t *)arg, 1, -1);
+}
+
+static void test_credits(void) {
+  pool_t *p = pool_create(1, 4);
+  TEST_ASSERT(p != NULL, "pool create");
+
+  atomic_int counter, gate;
+  atomic_init(&counter, 0);
+  atomic_init(&gate, 0);
+
+  // Pools that never take credits have no credit queue.
+  TEST_ASSERT(atomic_load(&p->credit) == NULL, "credit queue created on demand");
+  pool_release_credits(p, 1);
+  TEST_ASSERT(atomic_load(&p->credit) == NULL, "release before any acquire does nothing");
+  TEST_ASSERT(p->q->capacity == 4, "global ring not enlarged");
+
+  // Hold the worker, then spend every credit.
+  TEST_ASSERT(pool_submit(p, gate_job, &gate) == 0, "submit gate");
+  while (atomic_load(&p->q->enqueue_pos) != atomic_load(&p->q->dequeue_pos)) usleep(100);
+  TEST_ASSERT(pool_acquire_credits(p, 5, 0) == -1, "more credits than the pool has");
+  TEST_ASSERT(pool_acquire_credits(p, 4, 0) == 0, "credits available");
+  TEST_ASSERT(pool_acquire_credits(p, 1, 0) == -1, "credits exhausted");
+  TEST_ASSERT(pool_acquire_credits(p, 1, 1000000) == -1, "acquire times out");
+  for (int i = 0; i < 4; ++i) pool_submit_credited(p, increment_job, &counter);
+
+  // Credited jobs take nothing from ordinary submits.
+  int accepted = 0;
+  for (int i = 0; i < 4; ++i) {
+    TEST_ASSERT(pool_submit(p, increment_job, &counter) == 0, "capacity plain submits fit");
+    ++accepted;
+  }
+  TEST_ASSERT(pool_submit(p, increment_job, &counter) == -1, "plain submits still bounded");
+
+  // A waiter sleeps until a worker takes a credited job.
+  pthread_t waiter;
+  void *ret;
+  pthread_create(&waiter, NULL, credit_waiter, p);
+  atomic_store_explicit(&gate, 1, memory_order_release);
+  pthread_join(waiter, &ret);
+  TEST_ASSERT((intptr_t)ret == 0, "waiter gets a returned credit");
+  pool_submit_credited(p, increment_job, &counter);
+  pool_wait(p);
+  TEST_ASSERT(atomic_load_explicit(&counter, memory_order_relaxed) == accepted + 5,
+    "all jobs executed");
+
+  TEST_ASSERT(pool_acquire_credits(p, 4, 0) == 0, "every credit came back");
+  pool_release_credits(p, 4);
+  TEST_ASSERT(pool_acquire_credits(p, 4, 0) == 0, "released credits are free again");
+  pool_release_credits(p, 4);
+  pool_destroy(p, 1);
+}
+
+typedef struct {
+  pool_t *pool;
+  atomic_int runs;
+  atomic_int resubmitted;
+} coalesce_ctx_t;
+
+// Resubmits its own key while running: the key must already be clear.
+static void coalesce_self_job(void *arg) {
+  coalesce_ctx_t *c = (coalesce_ctx_t *)arg;
+  if (atomic_fetch_add_explicit(&c->runs, 1, memory_order_relaxed) < 3 &&
+      pool_submit_coalesced(c->pool, 42, coalesce_self_job, c) == 0)
+    atomic_fetch_add_explicit(&c->resubmitted, 1, memory_order_relaxed);
+}
+
+static void test_coalesced_submit(void) {
+  pool_t *p = pool_create(1, 64);
+  TEST_ASSERT(p != NULL, "pool create");
+
+  atomic_int a, b, gate;
+  atomic_init(&a, 0);
+  atomic_init(&b, 0);
+  atomic_init(&gate, 0);
+
+  TEST_ASSERT(pool_submit(p, gate_job, &gate) == 0, "submit gate");
+  TEST_ASSERT(pool_submit_coalesced(p, 7, increment_job, &a) == 0, "first submit queued");
+  for (int i = 0; i < 100; ++i)
+    TEST_ASSERT(pool_submit_coalesced(p, 7, increment_job, &a) == 1, "duplicate dropped");
+  TEST_ASSERT(pool_submit_coalesced(p, 8, increment_job, &b) == 0, "other key queued");
+  TEST_ASSERT(pool_submit_coalesced(p, 0, increment_job, &b) == 0, "key 0 never coalesced");
+  TEST_ASSERT(pool_submit_coalesced(p, 0, increment_job, &b) == 0, "key 0 never coalesced");
+  atomic_store_explicit(&gate, 1, memory_order_release);
+  pool_wait(p);
+  TEST_ASSERT(atomic_load(&a) == 1, "duplicates ran once");
+  TEST_ASSERT(atomic_load(&b) == 3, "distinct jobs all ran");
+
+  TEST_ASSERT(pool_submit_coalesced(p, 7, increment_job, &a) == 0, "key free once its job ran");
+  pool_wait(p);
+  TEST_ASSERT(atomic_load(&a) == 2, "resubmitted key ran");
+
+  coalesce_ctx_t c = { .pool = p };
+  atomic_init(&c.runs, 0);
+  atomic_init(&c.resubmitted, 0);
+  TEST_ASSERT(pool_submit_coalesced(p, 42, coalesce_self_job, &c) == 0, "submit self job");
+  pool_wait(p);
+  TEST_ASSERT(atomic_load(&c.resubmitted) == 3 && atomic_load(&c.runs) == 4,
+    "key cleared when the job starts");
+
+  pool_destroy(p, 1);
+}
+
+static void test_class_rate(void) {
+  pool_t *p = pool_create(1, 64);
+  TEST_ASSERT(p != NULL, "pool create");
+
+  atomic_int limited, other, unlimited;
+  atomic_init(&limited, 0);
+  atomic_init(&other, 0);
+  atomic_init(&unlimited, 0);
+
+  TEST_ASSERT(pool_set_class_rate(p, POOL_CLASSES, 10, 1) == -1, "class out of range");
+  TEST_ASSERT(pool_submit_class(p, 2, increment_job, &limited) == -1, "class not set up");
+  TEST_ASSERT(pool_set_class_rate(p, 1, 50, 2) == 0, "set rate");
+  TEST_ASSERT(pool_set_class_rate(p, 3, 0, 0) == 0, "set unlimited class");
+
+  // 10 jobs at 50/s with bursts of 2 take at least 8 intervals of 20ms.
+  uint64_t t0 = mpmc_spin_clock_ns();
+  for (int i = 0; i < 10; ++i)
+    TEST_ASSERT(pool_submit_class(p, 1, increment_job, &limited) == 0, "submit limited");
+  for (int i = 0; i < 10; ++i)
+    TEST_ASSERT(pool_submit_class(p, 3, increment_job, &unlimited) == 0, "submit unlimited");
+
+  // The only worker keeps running other jobs while the class waits.
+  TEST_ASSERT(pool_submit(p, increment_job, &other) == 0, "submit other");
+  while (atomic_load(&other) == 0 || atomic_load(&unlimited) < 10) usleep(100);
+  TEST_ASSERT(atomic_load(&limited) < 10, "other work overtakes the limited class");
+
+  pool_wait(p);
+  uint64_t elapsed = mpmc_spin_clock_ns() - t0;
+  TEST_ASSERT(atomic_load(&limited) == 10, "limited jobs all ran");
+  TEST_ASSERT(elapsed >= 150000000u, "rate enforced");
+
+  pool_destroy(p, 1);
+}
+
+// Workers with only over-rate class jobs left must sleep, not wake each
+// other until the rate allows the next one.
+static void test_class_rate_idle(void) {
+  pool_t *p = pool_create(2, 64);
+  TEST_ASSERT(p != NULL, "pool create");
+
+  atomic_int ran;
+  atomic_init(&ran, 0);
+  TEST_ASSERT(pool_set_class_rate(p, 0, 2, 1) == 0, "set rate");
+  for (int i = 0; i < 4; ++i)
+    TEST_ASSERT(pool_submit_class(p, 0, increment_job, &ran) == 0, "submit limited");
+  while (atomic_load(&ran) == 0) usleep(100);
+  usleep(10000);
+
+  uint64_t cpu0 = process_cpu_ns(), t0 = mpmc_spin_clock_ns();
+  usleep(300000);
+  uint64_t cpu = process_cpu_ns() - cpu0, wall = mpmc_spin_clock_ns() - t0;
+  TEST_ASSERT(atomic_load(&ran) == 1, "rate still holds the backlog");
+  TEST_ASSERT(cpu < wall / 10, "idle workers sleep while the class is over its rate");
+
+  pool_destroy(p, 0);
+}
+
+typedef struct {
+  atomic_ullong ran_at;
+} stamp_t;
+
+static void stamp_job(void *arg) {
+  atomic_store(&((stamp_t *)arg)->ran_at, mpmc_spin_clock_ns());
+}
+
+// A spinning worker picks up class jobs as quickly as plain ones.
+static void test_class_latency_hot_worker(void) {
+  pool_t *p = pool_create(2, 64);
+  TEST_ASSERT(p != NULL, "pool create");
+  pool_idle_policy_t hot = { .hot_workers = 1, .hot_ns = 1000000000u, .cold_ns = 0 };
+  TEST_ASSERT(pool_set_idle_policy(p, &hot) == 0, "set idle policy");
+  TEST_ASSERT(pool_set_class_rate(p, 0, 0, 0) == 0, "set unlimited class");
+  usleep(20000);  // let the hot worker start spinning and the other park
+
+  stamp_t s;
+  atomic_init(&s.ran_at, 0);
+  uint64_t t0 = mpmc_spin_clock_ns();
+  TEST_ASSERT(pool_submit_class(p, 0, stamp_job, &s) == 0, "submit class job");
+  while (atomic_load(&s.ran_at) == 0) usleep(100);
+  TEST_ASSERT(atomic_load(&s.ran_at) - t0 < 100000000u, "class job starts without waiting out the spin");
+
+  pool_set_idle_policy(p, &(pool_idle_policy_t){ .hot_workers = 0, .hot_ns = 0, .cold_ns = 0 });
+  pool_destroy(p, 1);
+}
+
+// A class job, even one with no rate limit, still runs while the global ring
+// never runs dry.
+static void test_class_under_busy_ring(void) {
+  pool_t *p = pool_create(2, 64);
+  TEST_ASSERT(p != NULL, "pool create");
+  TEST_ASSERT(pool_set_class_rate(p, 0, 0, 0) == 0, "set class rate");
+
+  churn_t churn;
+  churn_start(&churn, p, 8);
+  atomic_int ran;
+  atomic_init(&ran, 0);
+  TEST_ASSERT(pool_submit_class(p, 0, set_flag_job, &ran) == 0, "submit class job");
+  int in_time = wait_flag(&ran);
+  atomic_store_explicit(&churn.stop, 1, memory_order_relaxed);
+  pool_wait(p);
+  TEST_ASSERT(in_time, "class job runs while the global ring is busy");
+
+  pool_destroy(p, 1);
+}
+
 static void test_destroy_without_wait(void) {
   pool_t *p = pool_create(2, 16);
   TEST_ASSERT(p != NULL, "pool create");
@@ -212,8 +1007,31 @@ int main(void) {
   test_multiple_jobs();
   test_queue_full_nonblocking();
   test_submit_blocking();
+  test_backoff_policies();
   test_concurrent_submits();
   test_concurrent_producers();
+  test_wait_race_stress();
+  test_wait_covers_nested_jobs();
+  test_wait_until_ticket();
+  test_spawn_sync();
+  test_flat_combining_submit();
+  test_local_ring_submit();
+  test_cache_topology();
+  test_steal_half();
+  test_elimination_handoff();
+  test_parked_handoff();
+  test_lifo_wake_order();
+  test_hot_worker_policy();
+  test_hot_worker_skips_idle_stack();
+  test_run_stream();
+  test_run_stream_blocking_generator();
+  test_credits();
+  test_credits_under_busy_ring();
+  test_coalesced_submit();
+  test_class_rate();
+  test_class_rate_idle();
+  test_class_latency_hot_worker();
+  test_class_under_busy_ring();
   test_destroy_without_wait();
   printf("OK: thread pool tests passed\n");
   return 0;
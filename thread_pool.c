@@ -11,11 +11,30 @@
  * Notes:
  * - If you expect producers to be faster than consumers, configure a larger capacity.
  */
- 
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
 #include <stdlib.h>
 #include <stdint.h>
+#include <sched.h>
 #include "thread_pool.h"
 #include "mpmc_sem.h"
+#include "mpmc_spin.h"
+#include "pool_topo.h"
+
+// How long a consumer waits for a reserved slot to be published before
+// re-reading the position.
+#define MPMC_PUBLISH_WAIT_NS 2000
+// How long an idle consumer watches for new work before sleeping on the
+// semaphore. Skipped on single-CPU machines, where the producer cannot run
+// while we spin.
+#define MPMC_IDLE_SPIN_NS 10000
+// Pause per position a thread fell behind after losing a position CAS, and
+// the cap on that pause.
+#define MPMC_CONTENTION_NS 25
+#define MPMC_CONTENTION_MAX_NS 1000
 
 // internal MPMC queue based on Vyukov's algorithm
 typedef struct {
@@ -40,6 +59,7 @@ static size_t next_power_of_two(size_t x) {
 }
 
 static mpmc_queue_t *mpmc_queue_create(size_t capacity) {
+  mpmc_spin_calibrate();
   capacity = next_power_of_two(capacity);
   mpmc_queue_t *q = malloc(sizeof(*q));
   if (!q) return NULL;
@@ -69,68 +89,177 @@ static void mpmc_queue_destroy(mpmc_queue_t *q) {
   free(q);
 }
 
-// Non-blocking enqueue. Returns 0 on success, -1 if full.
-static int mpmc_enqueue_nb(mpmc_queue_t *q, job_t job) {
+// Contention management for the position CASes. A thread whose CAS lost to
+// `behind` other claims knows that many threads are hitting the line; pausing
+// in proportion lets the winners' stores drain instead of immediately pulling
+// the line back. Losing to a single claim is normal and retried at once.
+static inline void mpmc_contention_backoff(size_t behind) {
+  if (behind <= 1 || mpmc_spin_cal.single_cpu) return;
+  uint64_t ns = (uint64_t)behind * MPMC_CONTENTION_NS;
+  mpmc_spin_ns(ns < MPMC_CONTENTION_MAX_NS ? ns : MPMC_CONTENTION_MAX_NS);
+}
+
+// Non-blocking enqueue. Returns 0 on success, -1 if full. On success the
+// reserved ring position is stored in `*pos_out` if it is non-NULL. If
+// `lost_out` is non-NULL it receives the number of claims by other producers
+// that beat this one, a measure of contention on enqueue_pos.
+static int mpmc_enqueue_pos(mpmc_queue_t *q, job_t job, size_t *pos_out, size_t *lost_out) {
+  size_t lost = 0;
   size_t pos = atomic_load_explicit(&q->enqueue_pos, memory_order_relaxed);
   for (;;) {
     node_t *node = &q->buffer[pos & q->mask];
     size_t seq = atomic_load_explicit(&node->seq, memory_order_acquire);
     intptr_t dif = (intptr_t)seq - (intptr_t)pos;
     if (dif == 0) {
+      size_t mine = pos;
       if (atomic_compare_exchange_weak_explicit(&q->enqueue_pos, &pos, pos + 1,
-        memory_order_relaxed, memory_order_relaxed)) {
+        memory_order_seq_cst, memory_order_relaxed)) {
         // we've reserved the slot
         node->job = job; // copy job
         // publish by setting seq = pos+1
         atomic_store_explicit(&node->seq, pos + 1, memory_order_release);
         // signal availability
         mpmc_sem_post(&q->available);
+        if (pos_out) *pos_out = pos;
+        if (lost_out) *lost_out = lost;
         return 0;
       }
       // CAS failed - pos updated to new value by CAS; loop with that pos
+      lost += pos - mine;
+      mpmc_contention_backoff(pos - mine);
     } else if (dif < 0) {
+        if (lost_out) *lost_out = lost;
         return -1;  // queue is full
+    } else if (dif == 1) {
+      // slot already published by whoever claimed pos: skip ahead to the next
+      // slot instead of re-reading the contended enqueue_pos line
+      ++pos;
     } else {
       pos = atomic_load_explicit(&q->enqueue_pos, memory_order_relaxed);
     }
   }
 }
 
-// Blocking enqueue with exponential backoff. Returns 0 on success, -1 on error.
-static int mpmc_enqueue_blocking(mpmc_queue_t *q, job_t job) {
-  int spin = 1;
+// Non-blocking enqueue. Returns 0 on success, -1 if full.
+static int mpmc_enqueue_nb(mpmc_queue_t *q, job_t job) {
+  return mpmc_enqueue_pos(q, job, NULL, NULL);
+}
+
+// Enqueue up to `n` jobs at consecutive positions with a single claim on
+// enqueue_pos. Returns how many were enqueued (0 if the queue is full), the
+// first position going to `*pos_out`.
+//
+// The claim only covers slots whose previous occupants the consumers have
+// already claimed (dequeue_pos is read first), so each slot is at worst still
+// being copied out and becomes free almost immediately. Other producers may
+// move enqueue_pos meanwhile and consumers follow them, so a `pos` that has
+// fallen behind the head is reloaded rather than taken as a full queue.
+static size_t mpmc_enqueue_batch(mpmc_queue_t *q, const job_t *jobs, size_t n, size_t *pos_out) {
+  size_t pos = atomic_load_explicit(&q->enqueue_pos, memory_order_relaxed);
+  size_t k;
+  for (;;) {
+    size_t head = atomic_load_explicit(&q->dequeue_pos, memory_order_relaxed);
+    size_t used = pos - head;
+    if ((intptr_t)used < 0) {
+      pos = atomic_load_explicit(&q->enqueue_pos, memory_order_relaxed);
+      continue;
+    }
+    k = used >= q->capacity ? 0 : q->capacity - used;
+    if (k > n) k = n;
+    if (k == 0) return 0;
+    size_t mine = pos;
+    if (atomic_compare_exchange_weak_explicit(&q->enqueue_pos, &pos, pos + k,
+      memory_order_seq_cst, memory_order_relaxed))
+      break;
+    mpmc_contention_backoff(pos - mine);
+  }
+  for (size_t i = 0; i < k; ++i) {
+    node_t *node = &q->buffer[(pos + i) & q->mask];
+    size_t seq;
+    while ((seq = atomic_load_explicit(&node->seq, memory_order_acquire)) != pos + i)
+      mpmc_spin_until_change(&node->seq, seq, MPMC_PUBLISH_WAIT_NS);
+    node->job = jobs[i];
+    atomic_store_explicit(&node->seq, pos + i + 1, memory_order_release);
+  }
+  for (size_t i = 0; i < k; ++i) mpmc_sem_post(&q->available);
+  *pos_out = pos;
+  return k;
+}
+
+// One round of backoff for a producer that found the queue full, watching
+// the head slot rather than enqueue_pos. The distance is how many slots must
+// still be freed before the producer's turn. If consumers have already moved
+// past the `pos` read here, the queue has room and there is nothing to wait
+// for.
+static void mpmc_full_backoff(mpmc_queue_t *q, mpmc_backoff_t *b) {
+  size_t pos = atomic_load_explicit(&q->enqueue_pos, memory_order_relaxed);
+  size_t head = atomic_load_explicit(&q->dequeue_pos, memory_order_relaxed);
+  size_t used = pos - head;
+  if ((intptr_t)used < 0) return;
+  node_t *node = &q->buffer[pos & q->mask];
+  size_t seq = atomic_load_explicit(&node->seq, memory_order_relaxed);
+  if (seq != pos)
+    mpmc_backoff_wait(b, used >= q->capacity ? used - q->capacity + 1 : 1, &node->seq, seq);
+}
+
+// Blocking enqueue. Returns 0 on success, -1 on error. While the queue is
+// full the producer backs off under `policy`.
+static int mpmc_enqueue_blocking(mpmc_queue_t *q, job_t job, const pool_backoff_t *policy) {
+  mpmc_backoff_t b;
+  mpmc_backoff_init(&b, policy);
   while (1) {
     if (mpmc_enqueue_nb(q, job) == 0) return 0;
-    // queue full - backoff
-    if (spin < 32) {
-      for (int i = 0; i < (1 << spin); ++i) SPIN_HINT();
-      ++spin;
-    } else {
-      sched_yield();
-    }
+    mpmc_full_backoff(q, &b);
   }
   return -1;
 }
 
-// Blocking dequeue that waits on semaphore. Returns 0 on success and fills job.
-// Returns -1 if interrupted by shutdown (the caller should check pool state separately).
-static int mpmc_dequeue_wait(mpmc_queue_t *q, job_t *out_job) {
-  // wait for available count
-  if (mpmc_sem_wait(&q->available) != 0) return -1;
+// Enqueue where the caller guarantees a free slot (see pool_submit_credited()):
+// the position is claimed with a plain fetch_add, no full check, and at worst
+// waits for a consumer to finish copying the slot's previous job out.
+static void mpmc_enqueue_reserved(mpmc_queue_t *q, job_t job) {
+  size_t pos = atomic_fetch_add_explicit(&q->enqueue_pos, 1, memory_order_seq_cst);
+  node_t *node = &q->buffer[pos & q->mask];
+  size_t seq;
+  while ((seq = atomic_load_explicit(&node->seq, memory_order_acquire)) != pos)
+    mpmc_spin_until_change(&node->seq, seq, MPMC_PUBLISH_WAIT_NS);
+  node->job = job;
+  atomic_store_explicit(&node->seq, pos + 1, memory_order_release);
+  mpmc_sem_post(&q->available);
+}
+
+// Claim and copy out the oldest job. The caller must hold one unit of the
+// `available` count, which guarantees a job is (or is about to be) published.
+//
+// If `claim` is non-NULL, the position about to be claimed is stored there
+// before each CAS attempt. The successful CAS is a release, so anyone who
+// observes dequeue_pos past a position also observes the claim of whoever took
+// it (see pool_watermark()).
+static int mpmc_dequeue_take(mpmc_queue_t *q, job_t *out_job, atomic_size_t *claim) {
   size_t pos = atomic_load_explicit(&q->dequeue_pos, memory_order_relaxed);
   for (;;) {
     node_t *node = &q->buffer[pos & q->mask];
     size_t seq = atomic_load_explicit(&node->seq, memory_order_acquire);
-    size_t dif = seq - (pos + 1);
+    intptr_t dif = (intptr_t)seq - (intptr_t)(pos + 1);
     if (dif == 0) {
+      size_t mine = pos;
+      if (claim) atomic_store_explicit(claim, pos, memory_order_relaxed);
       if (atomic_compare_exchange_weak_explicit(&q->dequeue_pos, &pos, pos + 1,
-        memory_order_relaxed, memory_order_relaxed)) {
+        memory_order_release, memory_order_relaxed)) {
         // we've reserved the slot
         *out_job = node->job; // copy
         // mark slot as free for producers: seq = pos + capacity
         atomic_store_explicit(&node->seq, pos + q->capacity, memory_order_release);
         return 0;
       }
+      mpmc_contention_backoff(pos - mine);
+    } else if ((size_t)dif == q->capacity - 1) {
+      // slot already consumed by whoever claimed pos this lap: skip ahead
+      ++pos;
+    } else if (dif < 0) {
+      // a producer has reserved this slot but not published it yet
+      mpmc_spin_until_change(&node->seq, seq, MPMC_PUBLISH_WAIT_NS);
+      pos = atomic_load_explicit(&q->dequeue_pos, memory_order_relaxed);
     } else {
       pos = atomic_load_explicit(&q->dequeue_pos, memory_order_relaxed);
     }
@@ -138,41 +267,877 @@ static int mpmc_dequeue_wait(mpmc_queue_t *q, job_t *out_job) {
   return -1;
 }
 
+// Non-blocking dequeue. Returns 0 on success and fills job, -1 if empty.
+static int mpmc_dequeue_try(mpmc_queue_t *q, job_t *out_job, atomic_size_t *claim) {
+  if (mpmc_sem_trywait(&q->available) != 0) return -1;
+  return mpmc_dequeue_take(q, out_job, claim);
+}
+
 /* ---------------- Thread Pool ---------------- */
 
+/*
+ * Memory ordering on the hot paths (tests/test_litmus.c exercises each edge):
+ *
+ * - Job hand-off goes through the slot `seq`: the producer's release store
+ *   publishes the job, the consumer's acquire load reads it. The consumer's
+ *   release store freeing the slot pairs with the producer's acquire load so
+ *   the copy-out finishes before the slot is overwritten. The dequeue CAS
+ *   releases the worker's claim; the enqueue CAS is seq_cst for the parking
+ *   protocol below (free on x86, where a locked CAS is a full barrier).
+ * - Completion goes through the per-worker `completed` and `active` words:
+ *   release stores by the owner after the job, acquire loads by waiters. The
+ *   owner's increment is a plain load/store, not an RMW.
+ * - Elimination hands the job over through the worker's exchange slot: the
+ *   submitter's claim CAS acquires the worker's offer, and its release store
+ *   of XCHG_FULL publishes the job and the `xchg_handed` count together.
+ * - Flat-combining requests and their results go through the request slot's
+ *   `state` with release/acquire in both directions; the combiner lock is an
+ *   acquire CAS / release store.
+ * - Credits are counted in the credit queue's `free` word with seq_cst RMWs;
+ *   a credited or class job publishes through the slot `seq` like any other,
+ *   and the consumer of a credited job returns the credit after freeing the
+ *   slot.
+ * - `work_hint` carries no data: a spinner that sees it takes the job through
+ *   the ring it was put on (local_tail store / acquire load).
+ * - `accepting` only gates submissions and publishes no data, so it is read
+ *   relaxed. Submitting concurrently with pool_destroy() is not supported.
+ * - Parking pairs the seq_cst enqueue CAS (or local_tail store) and
+ *   n_spinning / idle-stack reads on the submit side with the seq_cst
+ *   n_spinning decrement, idle-stack push and ring reads on the worker side,
+ *   so a job is never left on the ring with every worker asleep. A parked
+ *   worker's mailbox is published by a release store of XCHG_FULL and the
+ *   wakeup itself goes through its semaphore. No fences are used.
+ */
+
+#define CACHE_LINE 64
+
+// `active` value of a worker that is not running a ring job.
+#define TICKET_IDLE SIZE_MAX
+
+// Exchange slot (mailbox) states, see pool_exchange_wait() and pool_park().
+enum { XCHG_EMPTY, XCHG_WAITING, XCHG_CLAIMED, XCHG_FULL, XCHG_PARKED };
+
+// Per-worker submission ring size (power of two), see local_push().
+#define LOCAL_RING 256
+// Every this many jobs a worker checks the global ring before its own.
+#define LOCAL_GLOBAL_EVERY 61
+// Every this many jobs a worker checks the credited and class queues before
+// the rings.
+#define SIDE_QUEUES_EVERY 31
+
+typedef struct {
+  _Atomic(job_fn) func;
+  _Atomic(void *) arg;
+} local_slot_t;
+
+// Per-worker state. Each worker owns one cache line and is the only writer of
+// its counters, so completing a job never touches a line shared with others.
+// The exchange slot, which doubles as the mailbox of a parked worker, sits on
+// a second line since submitters write it, and the parking state on a third.
+// The front of the local submission ring, which any worker may take from,
+// gets a fourth.
+typedef struct {
+  atomic_size_t completed; // jobs this worker has finished (single writer)
+  atomic_size_t active;    // ring position being run, or TICKET_IDLE
+  atomic_size_t local_tail; // end of the local ring (single writer)
+  atomic_size_t local_pushed; // jobs submitted through it (single writer)
+  pool_t *pool;
+  unsigned tick;           // jobs looked for, see worker_next()
+  atomic_int cpu;          // CPU last seen running on, -1 if unknown
+  char pad0[CACHE_LINE - 4 * sizeof(atomic_size_t) - sizeof(pool_t *) - sizeof(unsigned) -
+            sizeof(atomic_int)];
+  atomic_size_t xchg_state;  // XCHG_* above
+  atomic_size_t xchg_handed; // jobs handed over through the slot
+  job_t xchg_job;
+  char pad1[CACHE_LINE - 2 * sizeof(atomic_size_t) - sizeof(job_t)];
+  // mpmc_sem_t differs in size across platforms, so align rather than pad.
+  mpmc_sem_t wake __attribute__((aligned(CACHE_LINE))); // parked worker sleeps here
+  atomic_uint idle_next;     // idle stack link: worker index + 1, 0 = none
+  atomic_uint poll_ns;       // how long to offer the exchange slot when idle
+  atomic_size_t local_head __attribute__((aligned(CACHE_LINE))); // next job to take
+  local_slot_t local[LOCAL_RING] __attribute__((aligned(CACHE_LINE)));
+} worker_t;
+
+/*
+ * Flat combining for the submit path. Under heavy contention producers stop
+ * fighting over enqueue_pos: each publishes its job in a per-thread request
+ * slot, and whichever producer takes the combiner lock enqueues every pending
+ * request with one claim (mpmc_enqueue_batch()) and hands back the results.
+ *
+ * The mode is adaptive. Direct submits that lose position CASes add to
+ * `fc_heat`; past FC_HEAT_ON the pool switches to combining. The combiner
+ * cools it down when batches stay small and switches back at zero.
+ */
+#define FC_SLOTS 64
+#define FC_LOST_THRESHOLD 2     // lost claims that count a submit as contended
+#define FC_HEAT_ON 64
+#define FC_HEAT_MAX 256
+
+enum { FC_EMPTY, FC_CLAIMED, FC_PENDING, FC_DONE, FC_FULL };
+
+typedef struct {
+  atomic_size_t state;  // FC_* above
+  job_t job;            // request, written by the owner
+  size_t ticket;        // result, written by the combiner
+  char pad[CACHE_LINE - sizeof(atomic_size_t) - sizeof(job_t) - sizeof(size_t)];
+} fc_slot_t;
+
+// A rate-limited job class: its own queue plus a GCRA token bucket. `tat` is
+// the theoretical arrival time of the next job; one may start once it is at
+// most `tolerance_ns` ahead of the clock, and each start moves it on by
+// `interval_ns`. An interval of 0 means no limit.
+typedef struct {
+  _Atomic(mpmc_queue_t *) q;
+  atomic_ullong interval_ns;
+  atomic_ullong tolerance_ns;
+  atomic_ullong tat;
+} job_class_t;
+
+// Queue of credited jobs, see pool_acquire_credits(). `free` counts the
+// credits not handed out; waiters for credits sleep on `cond`.
+typedef struct {
+  mpmc_queue_t *q;
+  atomic_size_t free;
+  atomic_int waiters;
+  pthread_mutex_t lock;
+  pthread_cond_t cond;
+} credit_queue_t;
+
 struct pool {
   mpmc_queue_t *q;
   pthread_t *threads;
+  worker_t *workers;      // cache-line aligned, n_threads entries
+  void *workers_mem;      // raw allocation backing `workers`
   size_t n_threads;
   atomic_int running;     // 1 = running, 0 = stopping
   atomic_int accepting;   // 1 = accept new jobs
-  atomic_size_t busy;     // number of workers currently executing jobs
-  atomic_size_t queued;   // number of jobs enqueued but not yet completed
+  pool_backoff_t backoff; // policy for every waiting path
+  fc_slot_t *fc;          // cache-line aligned, FC_SLOTS entries
+  void *fc_mem;           // raw allocation backing `fc`
+  atomic_int fc_enabled;  // submit through the combiner
+  atomic_int fc_heat;     // contention estimate driving fc_enabled
+  atomic_int fc_lock;     // held by the current combiner
+  atomic_int n_spinning;  // workers offering their exchange slot
+  atomic_uint spin_last;  // worker that most recently started spinning
+  atomic_int work_hint;   // see pool_hint_work()
+  _Atomic(credit_queue_t *) credit; // credited jobs, allocated on first use
+  atomic_ullong idle_head;  // stack of parked workers, see idle_push()
+  pool_topo_t topo;       // steal order, see pool_steal()
+  _Atomic(struct coalesce_slot *) coalesce; // pending keys, allocated on first use
+  job_class_t classes[POOL_CLASSES]; // rate-limited queues, see pool_class_take()
+  atomic_uint class_mask; // classes with a queue
+  atomic_uint class_timer; // worker index + 1 of the class timer, 0 = none
+  mpmc_sem_t timer_sem;   // the class timer sleeps here
 };
 
+static void *cache_align(void *p) {
+  return (void *)(((uintptr_t)p + CACHE_LINE - 1) & ~(uintptr_t)(CACHE_LINE - 1));
+}
+
+// Pending work is derived rather than counted: every accepted job advanced
+// enqueue_pos (of the global, credit or a class queue), a worker's `xchg_handed`
+// or a worker's `local_pushed` exactly once, and bumps exactly one worker's
+// `completed` when it finishes. The sums only grow, so they are compared only
+// when someone waits.
+static size_t pool_completed(pool_t *pool) {
+  size_t done = 0;
+  for (size_t i = 0; i < pool->n_threads; ++i)
+    done += atomic_load_explicit(&pool->workers[i].completed, memory_order_acquire);
+  return done;
+}
+
+// Relaxed is enough: callers read it after the acquire loads in
+// pool_completed(), which keep this load from moving ahead of them, and no
+// data is consumed through the position itself.
+static size_t pool_submitted(pool_t *pool) {
+  size_t submitted = atomic_load_explicit(&pool->q->enqueue_pos, memory_order_relaxed);
+  for (size_t i = 0; i < pool->n_threads; ++i)
+    submitted += atomic_load_explicit(&pool->workers[i].xchg_handed, memory_order_relaxed) +
+                 atomic_load_explicit(&pool->workers[i].local_pushed, memory_order_relaxed);
+  credit_queue_t *credit = atomic_load_explicit(&pool->credit, memory_order_acquire);
+  if (credit) submitted += atomic_load_explicit(&credit->q->enqueue_pos, memory_order_relaxed);
+  unsigned mask = atomic_load_explicit(&pool->class_mask, memory_order_acquire);
+  for (unsigned c = 0; mask; ++c, mask >>= 1) {
+    if (!(mask & 1)) continue;
+    mpmc_queue_t *q = atomic_load_explicit(&pool->classes[c].q, memory_order_relaxed);
+    submitted += atomic_load_explicit(&q->enqueue_pos, memory_order_relaxed);
+  }
+  return submitted;
+}
+
+// True once every job submitted so far has completed. Completions are read
+// before submissions: a finished job's slot reservation happens-before its
+// completion, so `done` can never exceed `submitted` and equality means no
+// job (including ones spawned by jobs counted in `done`) is still pending.
+static int pool_idle(pool_t *pool) {
+  size_t done = pool_completed(pool);
+  return done == pool_submitted(pool);
+}
+
+// Completion watermark: every ticket below the returned value has finished.
+// A ticket is finished once the consumers have moved past it and no worker
+// still has it claimed. Reading dequeue_pos with acquire makes the claims of
+// every position before it visible (mpmc_dequeue_take()), and a worker's
+// release of `active` after the job publishes the job's effects.
+static size_t pool_watermark(pool_t *pool) {
+  size_t mark = atomic_load_explicit(&pool->q->dequeue_pos, memory_order_acquire);
+  for (size_t i = 0; i < pool->n_threads; ++i) {
+    size_t active = atomic_load_explicit(&pool->workers[i].active, memory_order_acquire);
+    if (active < mark) mark = active;
+  }
+  return mark;
+}
+
+// Per-thread index spreading submitters over request slots, assigned on
+// first use.
+static atomic_uint next_submitter_id;
+static _Thread_local unsigned submitter_tid;
+
+static unsigned submitter_id(void) {
+  if (!submitter_tid) submitter_tid = atomic_fetch_add_explicit(&next_submitter_id, 1, memory_order_relaxed) + 1;
+  return submitter_tid;
+}
+
+/*
+ * Per-worker submission rings. A job submitted from inside a running job goes
+ * on its worker's own ring rather than the global one. Only the owner pushes,
+ * at local_tail, so a push is a plain store; any worker takes from the front
+ * with a CAS on local_head, so order stays FIFO. The owner runs its own ring
+ * first and idle peers take from it before they park.
+ *
+ * The owner's store of local_tail publishes the slot. A taker's CAS on
+ * local_head releases its read of the slot before the owner, which reads
+ * local_head with acquire, can reuse it; a taker that read a slot about to be
+ * reused had a stale head and loses the CAS. local_tail is stored seq_cst for
+ * the parking protocol, like the enqueue CAS. Submissions are counted
+ * separately in local_pushed, since stolen jobs also pass through the
+ * thief's ring.
+ *
+ * A push also raises the pool's `work_hint` flag, see pool_hint_work().
+ */
+static _Thread_local worker_t *current_worker;
+
+// Tell spinning workers that a job went somewhere they do not watch directly
+// (a local ring, the credit queue or a class queue). They poll this one word
+// instead of every such queue, and clear it when they go to look. It is only
+// raised if clear, so a busy pool does not keep writing the line. It is only a
+// hint: a local job whose flag is lost is still run by its owner, and parking
+// workers check every queue themselves.
+static inline void pool_hint_work(pool_t *pool) {
+  if (!atomic_load_explicit(&pool->work_hint, memory_order_relaxed))
+    atomic_store_explicit(&pool->work_hint, 1, memory_order_release);
+}
+
+// Submit `job` on the calling worker's ring. Returns -1 if it is full.
+static int local_push(worker_t *w, job_t job) {
+  size_t tail = atomic_load_explicit(&w->local_tail, memory_order_relaxed);
+  size_t head = atomic_load_explicit(&w->local_head, memory_order_acquire);
+  if (tail - head >= LOCAL_RING) return -1;
+  local_slot_t *slot = &w->local[tail & (LOCAL_RING - 1)];
+  atomic_store_explicit(&slot->func, job.func, memory_order_relaxed);
+  atomic_store_explicit(&slot->arg, job.arg, memory_order_relaxed);
+  size_t pushed = atomic_load_explicit(&w->local_pushed, memory_order_relaxed);
+  atomic_store_explicit(&w->local_pushed, pushed + 1, memory_order_relaxed);
+  atomic_store_explicit(&w->local_tail, tail + 1, memory_order_seq_cst);
+  pool_hint_work(w->pool);
+  return 0;
+}
+
+// Take the oldest job from `w`'s ring. Safe from any worker.
+static int local_take(worker_t *w, job_t *out) {
+  size_t head = atomic_load_explicit(&w->local_head, memory_order_acquire);
+  for (;;) {
+    size_t tail = atomic_load_explicit(&w->local_tail, memory_order_acquire);
+    if (head == tail) return -1;
+    local_slot_t *slot = &w->local[head & (LOCAL_RING - 1)];
+    job_t job = {
+      atomic_load_explicit(&slot->func, memory_order_relaxed),
+      atomic_load_explicit(&slot->arg, memory_order_relaxed),
+    };
+    if (atomic_compare_exchange_weak_explicit(&w->local_head, &head, head + 1,
+      memory_order_release, memory_order_acquire)) {
+      *out = job;
+      return 0;
+    }
+  }
+}
+
+// Least number of jobs taken in one steal from a victim at a given distance
+// level: coming back to a far victim costs more, so take more while there.
+#define STEAL_BATCH(level) ((size_t)1 << (level))
+
+// Move up to half of `victim`'s jobs (at least STEAL_BATCH(level) if it has
+// them) to the calling worker's own ring with a single claim, as Go's
+// runqsteal does. The oldest job is returned in `*out` rather than queued.
+// Returns the number of jobs taken.
+//
+// The jobs are copied into the thief's ring beyond its tail, where nobody
+// reads them, before the CAS on the victim's head claims them; if the victim
+// reused any of those slots meanwhile, its head has moved and the CAS fails.
+static size_t local_steal(worker_t *victim, worker_t *self, int level, job_t *out) {
+  size_t head = atomic_load_explicit(&victim->local_head, memory_order_acquire);
+  size_t tail = atomic_load_explicit(&self->local_tail, memory_order_relaxed);
+  size_t room = LOCAL_RING - (tail - atomic_load_explicit(&self->local_head, memory_order_acquire));
+  for (;;) {
+    size_t avail = atomic_load_explicit(&victim->local_tail, memory_order_acquire) - head;
+    if (avail == 0) return 0;
+    size_t n = avail - avail / 2;
+    if (n < STEAL_BATCH(level)) n = avail < STEAL_BATCH(level) ? avail : STEAL_BATCH(level);
+    if (n > room + 1) n = room + 1;
+
+    local_slot_t *first = &victim->local[head & (LOCAL_RING - 1)];
+    job_t job = {
+      atomic_load_explicit(&first->func, memory_order_relaxed),
+      atomic_load_explicit(&first->arg, memory_order_relaxed),
+    };
+    for (size_t i = 1; i < n; ++i) {
+      local_slot_t *from = &victim->local[(head + i) & (LOCAL_RING - 1)];
+      local_slot_t *to = &self->local[(tail + i - 1) & (LOCAL_RING - 1)];
+      atomic_store_explicit(&to->func, atomic_load_explicit(&from->func, memory_order_relaxed),
+                            memory_order_relaxed);
+      atomic_store_explicit(&to->arg, atomic_load_explicit(&from->arg, memory_order_relaxed),
+                            memory_order_relaxed);
+    }
+    if (atomic_compare_exchange_weak_explicit(&victim->local_head, &head, head + n,
+      memory_order_release, memory_order_acquire)) {
+      if (n > 1) atomic_store_explicit(&self->local_tail, tail + n - 1, memory_order_seq_cst);
+      *out = job;
+      return n;
+    }
+  }
+}
+
+// Take work from another worker's ring, trying victims nearest in the cache
+// hierarchy first (SMT sibling, shared LLC, same node, remote).
+static int pool_steal(pool_t *pool, worker_t *self, job_t *out) {
+  size_t n = pool->n_threads, me = (size_t)(self - pool->workers);
+  int cpu = atomic_load_explicit(&self->cpu, memory_order_relaxed);
+  for (int level = 0; level < POOL_TOPO_LEVELS; ++level) {
+    for (size_t i = 1; i < n; ++i) {
+      worker_t *w = &pool->workers[(me + i) % n];
+      int victim_cpu = atomic_load_explicit(&w->cpu, memory_order_relaxed);
+      if (pool_topo_distance(&pool->topo, cpu, victim_cpu) != level) continue;
+      if (local_steal(w, self, level, out) > 0) return 0;
+    }
+  }
+  return -1;
+}
+
+static int pool_local_pending(pool_t *pool) {
+  for (size_t i = 0; i < pool->n_threads; ++i) {
+    worker_t *w = &pool->workers[i];
+    if (atomic_load_explicit(&w->local_tail, memory_order_seq_cst) !=
+        atomic_load_explicit(&w->local_head, memory_order_relaxed))
+      return 1;
+  }
+  return 0;
+}
+
+/*
+ * Elimination: when the ring is empty, a submitter can hand its job straight
+ * to a worker that is spinning idle, skipping the ring slot and semaphore.
+ *
+ * An idle worker offers its exchange slot (XCHG_WAITING) and spins. A
+ * submitter claims the slot with a CAS (WAITING -> CLAIMED), which makes it
+ * the slot's only writer, fills in the job, counts it in `xchg_handed`, and
+ * publishes it (FULL, release). The worker withdraws the offer with the
+ * opposite CAS (WAITING -> EMPTY); if that fails a job is on its way.
+ *
+ * Submitters probe the most recently idle spinner first, like the parked
+ * stack below, so a light load keeps landing on the same warm workers.
+ */
+#define XCHG_POLL_NS 500  // how often a spinning worker also checks the rings
+#define XCHG_PROBES 4     // exchange slots a submitter looks at
+
+// Results of pool_exchange_wait().
+enum { SPIN_TIMEOUT, SPIN_JOB, SPIN_WORK };
+
+// Offer this worker's exchange slot for up to `spin_ns`, also watching the
+// global ring and the work hint for new work. Returns SPIN_JOB with `*job`
+// filled if a submitter handed one over, SPIN_WORK if new work showed up
+// elsewhere, SPIN_TIMEOUT if nothing did.
+static int pool_exchange_wait(pool_t *pool, worker_t *self, job_t *job, uint64_t spin_ns) {
+  atomic_size_t *tail_pos = &pool->q->enqueue_pos;
+  size_t tail = atomic_load_explicit(tail_pos, memory_order_relaxed);
+  uint64_t deadline = mpmc_spin_ticks() + mpmc_spin_ns_to_ticks(spin_ns);
+  int seen = SPIN_TIMEOUT;
+
+  atomic_store_explicit(&self->xchg_state, XCHG_WAITING, memory_order_release);
+  atomic_fetch_add_explicit(&pool->n_spinning, 1, memory_order_relaxed);
+  atomic_store_explicit(&pool->spin_last, (unsigned)(self - pool->workers), memory_order_relaxed);
+  do {
+    mpmc_spin_until_change(&self->xchg_state, XCHG_WAITING, XCHG_POLL_NS);
+    if (atomic_load_explicit(&self->xchg_state, memory_order_relaxed) != XCHG_WAITING) break;
+    if (atomic_load_explicit(tail_pos, memory_order_relaxed) != tail) {
+      seen = SPIN_WORK;
+      break;
+    }
+    if (atomic_load_explicit(&pool->work_hint, memory_order_acquire)) {
+      atomic_store_explicit(&pool->work_hint, 0, memory_order_relaxed);
+      seen = SPIN_WORK;
+      break;
+    }
+  } while (mpmc_spin_ticks() < deadline);
+  // seq_cst: pairs with the check in pool_wake_ring(), see there.
+  atomic_fetch_sub_explicit(&pool->n_spinning, 1, memory_order_seq_cst);
+
+  size_t st = XCHG_WAITING;
+  if (atomic_compare_exchange_strong_explicit(&self->xchg_state, &st, XCHG_EMPTY,
+    memory_order_relaxed, memory_order_relaxed))
+    return seen;
+  while ((st = atomic_load_explicit(&self->xchg_state, memory_order_acquire)) != XCHG_FULL)
+    mpmc_spin_until_change(&self->xchg_state, st, MPMC_PUBLISH_WAIT_NS);
+  *job = self->xchg_job;
+  atomic_store_explicit(&self->xchg_state, XCHG_EMPTY, memory_order_relaxed);
+  return SPIN_JOB;
+}
+
+// Hand `job` to a spinning worker if the pool is underloaded. Returns 0 on
+// success, -1 if the job should go through the ring.
+static int pool_exchange_offer(pool_t *pool, job_t job) {
+  if (atomic_load_explicit(&pool->n_spinning, memory_order_relaxed) == 0) return -1;
+  // Only bypass the ring when it is empty, so queued jobs are not overtaken.
+  if (atomic_load_explicit(&pool->q->enqueue_pos, memory_order_relaxed) !=
+      atomic_load_explicit(&pool->q->dequeue_pos, memory_order_relaxed))
+    return -1;
+
+  size_t n = pool->n_threads;
+  size_t probes = n < XCHG_PROBES ? n : XCHG_PROBES;
+  size_t first = atomic_load_explicit(&pool->spin_last, memory_order_relaxed);
+  for (size_t i = 0; i < probes; ++i) {
+    worker_t *w = &pool->workers[(first + i) % n];
+    size_t st = XCHG_WAITING;
+    if (atomic_load_explicit(&w->xchg_state, memory_order_relaxed) != XCHG_WAITING) continue;
+    if (!atomic_compare_exchange_strong_explicit(&w->xchg_state, &st, XCHG_CLAIMED,
+      memory_order_acquire, memory_order_relaxed))
+      continue;
+    w->xchg_job = job;
+    size_t handed = atomic_load_explicit(&w->xchg_handed, memory_order_relaxed);
+    atomic_store_explicit(&w->xchg_handed, handed + 1, memory_order_relaxed);
+    atomic_store_explicit(&w->xchg_state, XCHG_FULL, memory_order_release);
+    return 0;
+  }
+  return -1;
+}
+
+/*
+ * Credits. Credited jobs get their own queue, created by the first
+ * pool_acquire_credits() and as large as the global ring, so pools that never
+ * use credits pay nothing and credit holders never take space from ordinary
+ * submits. A credit is the right to one of its slots: acquiring takes from
+ * `free`, a credited submit uses one up, and the worker that dequeues the job
+ * gives it back. Jobs in the queue plus credits held never exceed its
+ * capacity, so a credited submit never finds it full (mpmc_enqueue_reserved()).
+ *
+ * Waiting for credits is the slow path and uses a mutex and condition
+ * variable. A releaser adds to `free` and then reads `waiters`; a waiter
+ * registers in `waiters` and then retries the take, both seq_cst, so one of
+ * them sees the other.
+ */
+static int credit_take(credit_queue_t *c, size_t n) {
+  size_t have = atomic_load_explicit(&c->free, memory_order_seq_cst);
+  while (have >= n) {
+    if (atomic_compare_exchange_weak_explicit(&c->free, &have, have - n,
+      memory_order_seq_cst, memory_order_relaxed))
+      return 0;
+  }
+  return -1;
+}
+
+static void credit_release(credit_queue_t *c, size_t n) {
+  atomic_fetch_add_explicit(&c->free, n, memory_order_seq_cst);
+  if (atomic_load_explicit(&c->waiters, memory_order_seq_cst) == 0) return;
+  pthread_mutex_lock(&c->lock);
+  pthread_cond_broadcast(&c->cond);
+  pthread_mutex_unlock(&c->lock);
+}
+
+// Take `n` credits, waiting up to `timeout_ns` (forever if negative) for
+// workers to return enough. Returns 0 on success, -1 on timeout or if `n`
+// exceeds the queue's capacity.
+static int credit_acquire(credit_queue_t *c, size_t n, long timeout_ns) {
+  if (n > c->q->capacity) return -1;
+  if (credit_take(c, n) == 0) return 0;
+  if (timeout_ns == 0) return -1;
+
+  struct timespec deadline;
+  clock_gettime(CLOCK_REALTIME, &deadline);
+  if (timeout_ns > 0) {
+    deadline.tv_sec += timeout_ns / 1000000000L;
+    deadline.tv_nsec += timeout_ns % 1000000000L;
+    if (deadline.tv_nsec >= 1000000000L) {
+      deadline.tv_nsec -= 1000000000L;
+      ++deadline.tv_sec;
+    }
+  }
+  int ret = 0;
+  pthread_mutex_lock(&c->lock);
+  atomic_fetch_add_explicit(&c->waiters, 1, memory_order_seq_cst);
+  while (credit_take(c, n) != 0) {
+    if (timeout_ns < 0) {
+      pthread_cond_wait(&c->cond, &c->lock);
+    } else if (pthread_cond_timedwait(&c->cond, &c->lock, &deadline) != 0) {
+      ret = credit_take(c, n);
+      break;
+    }
+  }
+  atomic_fetch_sub_explicit(&c->waiters, 1, memory_order_relaxed);
+  pthread_mutex_unlock(&c->lock);
+  return ret;
+}
+
+static void credit_queue_destroy(credit_queue_t *c) {
+  if (!c) return;
+  pthread_cond_destroy(&c->cond);
+  pthread_mutex_destroy(&c->lock);
+  mpmc_queue_destroy(c->q);
+  free(c);
+}
+
+static credit_queue_t *credit_queue_create(size_t capacity) {
+  credit_queue_t *c = malloc(sizeof(*c));
+  if (!c) return NULL;
+  c->q = mpmc_queue_create(capacity);
+  if (!c->q) { free(c); return NULL; }
+  if (pthread_mutex_init(&c->lock, NULL) != 0) {
+    mpmc_queue_destroy(c->q);
+    free(c);
+    return NULL;
+  }
+  if (pthread_cond_init(&c->cond, NULL) != 0) {
+    pthread_mutex_destroy(&c->lock);
+    mpmc_queue_destroy(c->q);
+    free(c);
+    return NULL;
+  }
+  atomic_init(&c->free, c->q->capacity);
+  atomic_init(&c->waiters, 0);
+  return c;
+}
+
+// The pool's credit queue, created on first use. NULL if allocation failed.
+static credit_queue_t *pool_credit_queue(pool_t *pool) {
+  credit_queue_t *c = atomic_load_explicit(&pool->credit, memory_order_acquire);
+  if (c) return c;
+  credit_queue_t *fresh = credit_queue_create(pool->q->capacity);
+  if (!fresh) return NULL;
+  if (atomic_compare_exchange_strong_explicit(&pool->credit, &c, fresh,
+    memory_order_acq_rel, memory_order_acquire))
+    return fresh;
+  credit_queue_destroy(fresh);
+  return c;
+}
+
+static int pool_credit_pending(pool_t *pool) {
+  credit_queue_t *c = atomic_load_explicit(&pool->credit, memory_order_acquire);
+  return c && atomic_load_explicit(&c->q->enqueue_pos, memory_order_seq_cst) !=
+              atomic_load_explicit(&c->q->dequeue_pos, memory_order_relaxed);
+}
+
+// Take a credited job and return its credit. Returns 0 with `*job` filled,
+// -1 if there is none. Workers try this every SIDE_QUEUES_EVERY lookups even
+// while the rings have jobs, see worker_next(), so credits keep coming back to
+// blocked producers under any load.
+static int pool_credit_take(pool_t *pool, job_t *job) {
+  credit_queue_t *c = atomic_load_explicit(&pool->credit, memory_order_acquire);
+  if (!c || mpmc_dequeue_try(c->q, job, NULL) != 0) return -1;
+  credit_release(c, 1);
+  return 0;
+}
+
+/*
+ * Rate-limited job classes. Jobs submitted with pool_submit_class() wait in
+ * their class's queue, and worker_next() only takes one when the class's
+ * token bucket (GCRA, see job_class_t) lets it start, so workers move on to
+ * other work instead of sleeping inside rate-limited jobs.
+ *
+ * When every class with pending jobs is over its rate, one idle worker
+ * becomes the class timer: it registers in `class_timer` and sleeps on
+ * `timer_sem` until the earliest class may start again, while the others
+ * park as usual. Whoever clears `class_timer` by CAS owns the single post
+ * that wakes it, and pool_wake_one() wakes the timer when no worker is
+ * parked, so it also picks up ordinary jobs while it waits. The class
+ * enqueue CAS and the timer's store are seq_cst like the parking protocol.
+ */
+// How long until class `c` may start a job, 0 if it may now.
+static uint64_t job_class_delay(job_class_t *c, uint64_t now) {
+  uint64_t tat = atomic_load_explicit(&c->tat, memory_order_relaxed);
+  uint64_t tolerance = atomic_load_explicit(&c->tolerance_ns, memory_order_relaxed);
+  return tat > now + tolerance ? tat - now - tolerance : 0;
+}
+
+// True if a parking worker must not sleep because of class jobs: some class
+// has jobs it may start now, or has jobs waiting for its rate while no worker
+// is the class timer. Jobs over their rate with a timer in place are left to
+// the timer; waking a peer for them would only have it park again.
+static int pool_class_runnable(pool_t *pool) {
+  unsigned mask = atomic_load_explicit(&pool->class_mask, memory_order_acquire);
+  uint64_t now = 0;
+  for (unsigned c = 0; mask; ++c, mask >>= 1) {
+    if (!(mask & 1)) continue;
+    job_class_t *cls = &pool->classes[c];
+    mpmc_queue_t *q = atomic_load_explicit(&cls->q, memory_order_relaxed);
+    if (atomic_load_explicit(&q->enqueue_pos, memory_order_seq_cst) ==
+        atomic_load_explicit(&q->dequeue_pos, memory_order_relaxed))
+      continue;
+    if (!atomic_load_explicit(&pool->class_timer, memory_order_seq_cst)) return 1;
+    if (!now) now = mpmc_spin_clock_ns();
+    if (job_class_delay(cls, now) == 0) return 1;
+  }
+  return 0;
+}
+
+// Take a token from class `c`. Returns 0 on success, -1 if over its rate.
+static int job_class_admit(job_class_t *c, uint64_t now) {
+  uint64_t interval = atomic_load_explicit(&c->interval_ns, memory_order_relaxed);
+  if (interval == 0) return 0;
+  uint64_t tolerance = atomic_load_explicit(&c->tolerance_ns, memory_order_relaxed);
+  unsigned long long tat = atomic_load_explicit(&c->tat, memory_order_relaxed);
+  for (;;) {
+    uint64_t base = tat > now ? tat : now;
+    if (base - now > tolerance) return -1;
+    if (atomic_compare_exchange_weak_explicit(&c->tat, &tat, base + interval,
+      memory_order_relaxed, memory_order_relaxed))
+      return 0;
+  }
+}
+
+// Wake the class timer, if one is waiting.
+static void pool_wake_timer(pool_t *pool) {
+  unsigned id = atomic_load_explicit(&pool->class_timer, memory_order_seq_cst);
+  if (id && atomic_compare_exchange_strong_explicit(&pool->class_timer, &id, 0,
+    memory_order_relaxed, memory_order_relaxed))
+    mpmc_sem_post(&pool->timer_sem);
+}
+
+/*
+ * Parked workers. A worker that found nothing to do pushes itself on a
+ * lock-free stack and sleeps on its own semaphore. The stack wakes the most
+ * recently parked worker first: under light load the same few workers, with
+ * warm caches and in shallow sleep states, keep taking jobs while the rest
+ * stay parked. Popping a worker off the stack gives the popper its mailbox
+ * (the exchange slot): a submitter writes the job there and posts that
+ * worker's semaphore, so exactly one thread wakes and it does not touch the
+ * ring at all. When jobs do go through the ring, the submitter pops a parked
+ * worker and wakes it with an empty mailbox.
+ *
+ * The stack head packs the top worker's index + 1 (0 = empty) in the low 32
+ * bits and an ABA tag in the high 32 bits.
+ *
+ * Lost wakeups are ruled out by a seq_cst pair: a submitter enqueues on the
+ * ring (seq_cst CAS on enqueue_pos) and then reads the stack head, while a
+ * parking worker pushes itself (seq_cst CAS on the head) and then reads
+ * enqueue_pos. At least one of them sees the other; a worker that sees a job
+ * after pushing wakes someone (possibly itself) to take it.
+ */
+#define IDLE_TAG_ONE ((unsigned long long)1 << 32)
+
+static void idle_push(pool_t *pool, worker_t *w) {
+  unsigned id = (unsigned)(w - pool->workers) + 1;
+  unsigned long long head = atomic_load_explicit(&pool->idle_head, memory_order_relaxed);
+  unsigned long long next;
+  do {
+    atomic_store_explicit(&w->idle_next, (unsigned)head, memory_order_relaxed);
+    next = ((head & ~0xffffffffull) + IDLE_TAG_ONE) | id;
+  } while (!atomic_compare_exchange_weak_explicit(&pool->idle_head, &head, next,
+    memory_order_seq_cst, memory_order_relaxed));
+}
+
+static worker_t *idle_pop(pool_t *pool) {
+  unsigned long long head = atomic_load_explicit(&pool->idle_head, memory_order_seq_cst);
+  while ((unsigned)head) {
+    worker_t *w = &pool->workers[(unsigned)head - 1];
+    unsigned next = atomic_load_explicit(&w->idle_next, memory_order_relaxed);
+    unsigned long long popped = ((head & ~0xffffffffull) + IDLE_TAG_ONE) | next;
+    if (atomic_compare_exchange_weak_explicit(&pool->idle_head, &head, popped,
+      memory_order_seq_cst, memory_order_seq_cst))
+      return w;
+  }
+  return NULL;
+}
+
+// Wake one parked worker, if any, to look at the ring; else the class timer.
+static void pool_wake_one(pool_t *pool) {
+  worker_t *w = idle_pop(pool);
+  if (w) mpmc_sem_post(&w->wake);
+  else pool_wake_timer(pool);
+}
+
+// Make sure someone will see a job just put on the global or a local ring. A
+// spinning worker will: it watches the rings and goes through pool_park()'s
+// check of them before sleeping. Leaving the job to it keeps parked workers
+// parked. The seq_cst load pairs with the seq_cst decrement in
+// pool_exchange_wait() the same way the stack head does with idle_push().
+static void pool_wake_ring(pool_t *pool) {
+  if (atomic_load_explicit(&pool->n_spinning, memory_order_seq_cst) > 0) return;
+  pool_wake_one(pool);
+}
+
+static int pool_ring_empty(pool_t *pool) {
+  return atomic_load_explicit(&pool->q->enqueue_pos, memory_order_seq_cst) ==
+         atomic_load_explicit(&pool->q->dequeue_pos, memory_order_relaxed);
+}
+
+// Give `job` to a parked worker through its mailbox. Returns 0 on success,
+// -1 if no worker is parked.
+static int pool_handoff(pool_t *pool, job_t job) {
+  worker_t *w = idle_pop(pool);
+  if (!w) return -1;
+  w->xchg_job = job;
+  size_t handed = atomic_load_explicit(&w->xchg_handed, memory_order_relaxed);
+  atomic_store_explicit(&w->xchg_handed, handed + 1, memory_order_relaxed);
+  atomic_store_explicit(&w->xchg_state, XCHG_FULL, memory_order_release);
+  mpmc_sem_post(&w->wake);
+  return 0;
+}
+
+// Park until woken. Returns 1 with `*job` filled if it arrived in the
+// mailbox, 0 if the worker was woken to look at the ring.
+static int pool_park(pool_t *pool, worker_t *self, job_t *job) {
+  atomic_store_explicit(&self->xchg_state, XCHG_PARKED, memory_order_relaxed);
+  idle_push(pool, self);
+  if (!pool_ring_empty(pool) || pool_local_pending(pool) || pool_credit_pending(pool) ||
+      pool_class_runnable(pool))
+    pool_wake_one(pool);
+  while (mpmc_sem_wait(&self->wake) != 0) {
+  }
+  // May have been moved while asleep.
+  atomic_store_explicit(&self->cpu, pool_topo_cpu(), memory_order_relaxed);
+  int full = atomic_load_explicit(&self->xchg_state, memory_order_acquire) == XCHG_FULL;
+  if (full) *job = self->xchg_job;
+  atomic_store_explicit(&self->xchg_state, XCHG_EMPTY, memory_order_relaxed);
+  return full;
+}
+
+// Take a job from a class that is under its rate, starting from a different
+// class each time. Returns 0 with `*job` filled, -1 if there is none. Like
+// the credited queue, the classes get a turn every SIDE_QUEUES_EVERY lookups.
+static int pool_class_take(pool_t *pool, worker_t *self, job_t *job) {
+  unsigned mask = atomic_load_explicit(&pool->class_mask, memory_order_acquire);
+  if (!mask) return -1;
+  uint64_t now = 0;
+  for (unsigned i = 0; i < POOL_CLASSES; ++i) {
+    unsigned c = (self->tick + i) % POOL_CLASSES;
+    if (!(mask & (1u << c))) continue;
+    job_class_t *cls = &pool->classes[c];
+    mpmc_queue_t *q = atomic_load_explicit(&cls->q, memory_order_relaxed);
+    if (atomic_load_explicit(&q->enqueue_pos, memory_order_relaxed) ==
+        atomic_load_explicit(&q->dequeue_pos, memory_order_relaxed))
+      continue;
+    if (!now) now = mpmc_spin_clock_ns();
+    if (job_class_admit(cls, now) != 0) continue;
+    if (mpmc_dequeue_try(q, job, NULL) != 0) {
+      // Someone else emptied it: hand the token back.
+      atomic_fetch_sub_explicit(&cls->tat,
+        atomic_load_explicit(&cls->interval_ns, memory_order_relaxed), memory_order_relaxed);
+      continue;
+    }
+    // More jobs this class may start now: get another worker on them.
+    if (atomic_load_explicit(&q->enqueue_pos, memory_order_relaxed) !=
+        atomic_load_explicit(&q->dequeue_pos, memory_order_relaxed) &&
+        job_class_delay(cls, now) == 0)
+      pool_wake_ring(pool);
+    return 0;
+  }
+  return -1;
+}
+
+// Called by a worker that found nothing to run. If some class has jobs
+// waiting for its rate, become the class timer (unless another worker is)
+// and sleep until the first of them may start or new work arrives. Returns 1
+// if the worker should look for work again, 0 if it should park.
+static int pool_class_wait(pool_t *pool, worker_t *self) {
+  unsigned mask = atomic_load_explicit(&pool->class_mask, memory_order_acquire);
+  if (!mask) return 0;
+  uint64_t now = mpmc_spin_clock_ns(), wait = UINT64_MAX;
+  for (unsigned c = 0; mask; ++c, mask >>= 1) {
+    if (!(mask & 1)) continue;
+    job_class_t *cls = &pool->classes[c];
+    mpmc_queue_t *q = atomic_load_explicit(&cls->q, memory_order_relaxed);
+    if (atomic_load_explicit(&q->enqueue_pos, memory_order_relaxed) ==
+        atomic_load_explicit(&q->dequeue_pos, memory_order_relaxed))
+      continue;
+    uint64_t d = job_class_delay(cls, now);
+    if (d < wait) wait = d;
+  }
+  if (wait == UINT64_MAX) return 0;
+  if (wait == 0) return 1;
+
+  unsigned id = 0, me = (unsigned)(self - pool->workers) + 1;
+  if (!atomic_compare_exchange_strong_explicit(&pool->class_timer, &id, me,
+    memory_order_seq_cst, memory_order_relaxed))
+    return 0;
+  // A job that arrived before the registration above has no one to wake us.
+  int woken = 0;
+  if (pool_ring_empty(pool) && !pool_local_pending(pool))
+    woken = mpmc_sem_timedwait(&pool->timer_sem, wait) == 0;
+  id = me;
+  if (!woken && !atomic_compare_exchange_strong_explicit(&pool->class_timer, &id, 0,
+    memory_order_relaxed, memory_order_relaxed)) {
+    // A waker took the registration, so its post is on the way.
+    while (mpmc_sem_wait(&pool->timer_sem) != 0) {
+    }
+  }
+  return 1;
+}
+
+// Find the next job: this worker's ring, then the global ring, then the
+// credited and rate-limited queues, then the other workers' rings. The global
+// ring goes first now and then, so a worker whose jobs keep spawning more
+// cannot starve it; the worker's CPU, which thieves use to pick victims, is
+// refreshed at the same time. The credited and class queues get such a turn
+// too, so a busy global ring cannot starve them.
+static int worker_next(pool_t *pool, worker_t *self, job_t *job) {
+  ++self->tick;
+  if (self->tick % SIDE_QUEUES_EVERY == 0 &&
+      (pool_credit_take(pool, job) == 0 || pool_class_take(pool, self, job) == 0))
+    return 0;
+  if (self->tick % LOCAL_GLOBAL_EVERY == 0) {
+    atomic_store_explicit(&self->cpu, pool_topo_cpu(), memory_order_relaxed);
+    if (mpmc_dequeue_try(pool->q, job, &self->active) == 0) return 0;
+  }
+  if (local_take(self, job) == 0) return 0;
+  if (mpmc_dequeue_try(pool->q, job, &self->active) == 0) return 0;
+  if (pool_credit_take(pool, job) == 0) return 0;
+  if (pool_class_take(pool, self, job) == 0) return 0;
+  return pool_steal(pool, self, job);
+}
+
+// Mark a job done. Only this thread writes `completed`, so a plain increment
+// published with release replaces the old shared fetch_add/fetch_sub pair.
+static void worker_completed(worker_t *self) {
+  size_t done = atomic_load_explicit(&self->completed, memory_order_relaxed);
+  atomic_store_explicit(&self->completed, done + 1, memory_order_release);
+}
+
 static void *worker(void *arg) {
-  pool_t *pool = (pool_t *)arg;
+  worker_t *self = (worker_t *)arg;
+  pool_t *pool = self->pool;
+  current_worker = self;
+  atomic_store_explicit(&self->cpu, pool_topo_cpu(), memory_order_relaxed);
   while (1) {
     job_t job;
-    if (mpmc_dequeue_wait(pool->q, &job) != 0) {
-      // sem_wait error; check if pool is stopping
-      if (!atomic_load_explicit(&pool->running, memory_order_acquire))
-        break;
-      continue;
+    if (worker_next(pool, self, &job) != 0) {
+      uint64_t spin_ns = atomic_load_explicit(&self->poll_ns, memory_order_relaxed);
+      int seen = spin_ns ? pool_exchange_wait(pool, self, &job, spin_ns) : SPIN_TIMEOUT;
+      // Work seen while spinning: go straight back for it rather than through
+      // the idle stack, where a peer parking meanwhile would be woken instead.
+      if (seen == SPIN_WORK) continue;
+      if (seen == SPIN_TIMEOUT && (pool_class_wait(pool, self) || !pool_park(pool, self, &job)))
+        continue;
     }
 
     // Poison pill (NULL function) indicates shutdown request
-    if (job.func == NULL) break;
-
-    // Mark this worker as busy
-    atomic_fetch_add_explicit(&pool->busy, 1, memory_order_acq_rel);
+    if (job.func == NULL) {
+      atomic_store_explicit(&self->active, TICKET_IDLE, memory_order_release);
+      break;
+    }
 
     // Execute the job
     job.func(job.arg);
 
-    // Mark done
-    atomic_fetch_sub_explicit(&pool->busy, 1, memory_order_acq_rel);
-    atomic_fetch_sub_explicit(&pool->queued, 1, memory_order_release);
+    worker_completed(self);
+    atomic_store_explicit(&self->active, TICKET_IDLE, memory_order_release);
   }
   return NULL;
 }
@@ -189,18 +1154,83 @@ pool_t *pool_create(size_t num_threads, size_t capacity) {
 
   pool->n_threads = num_threads;
   pool->threads = malloc(sizeof(pthread_t) * num_threads);
-  if (!pool->threads) { 
+  pool->workers_mem = malloc(sizeof(worker_t) * num_threads + CACHE_LINE);
+  pool->fc_mem = malloc(sizeof(fc_slot_t) * FC_SLOTS + CACHE_LINE);
+  if (!pool->threads || !pool->workers_mem || !pool->fc_mem) { 
+    free(pool->threads);
+    free(pool->workers_mem);
+    free(pool->fc_mem);
     mpmc_queue_destroy(pool->q);
     free(pool);
     return NULL;
   }
+  pool->workers = cache_align(pool->workers_mem);
+  for (size_t i = 0; i < num_threads; ++i) {
+    if (mpmc_sem_init(&pool->workers[i].wake, 0) != 0) {
+      while (i--) mpmc_sem_destroy(&pool->workers[i].wake);
+      free(pool->threads);
+      free(pool->workers_mem);
+      free(pool->fc_mem);
+      mpmc_queue_destroy(pool->q);
+      free(pool);
+      return NULL;
+    }
+  }
+  if (mpmc_sem_init(&pool->timer_sem, 0) != 0) {
+    for (size_t i = 0; i < num_threads; ++i) mpmc_sem_destroy(&pool->workers[i].wake);
+    free(pool->threads);
+    free(pool->workers_mem);
+    free(pool->fc_mem);
+    mpmc_queue_destroy(pool->q);
+    free(pool);
+    return NULL;
+  }
+  (void)pool_topo_load(&pool->topo); // stays flat on failure
   
   atomic_init(&pool->running, 1);
   atomic_init(&pool->accepting, 1);
-  atomic_init(&pool->busy, 0);
-  atomic_init(&pool->queued, 0);
+  pool->backoff = (pool_backoff_t){
+    .kind = POOL_BACKOFF_EXPONENTIAL,
+    .min_ns = 64,
+    .max_ns = 16000,
+    .spin_limit_ns = 200000,
+    .jitter = 1,
+  };
+  pool->fc = cache_align(pool->fc_mem);
+  for (size_t i = 0; i < FC_SLOTS; ++i) atomic_init(&pool->fc[i].state, FC_EMPTY);
+  atomic_init(&pool->fc_enabled, 0);
+  atomic_init(&pool->fc_heat, 0);
+  atomic_init(&pool->fc_lock, 0);
+  atomic_init(&pool->n_spinning, 0);
+  atomic_init(&pool->spin_last, 0);
+  atomic_init(&pool->work_hint, 0);
+  atomic_init(&pool->credit, NULL);
+  atomic_init(&pool->idle_head, 0);
+  atomic_init(&pool->coalesce, NULL);
+  for (size_t c = 0; c < POOL_CLASSES; ++c) {
+    atomic_init(&pool->classes[c].q, NULL);
+    atomic_init(&pool->classes[c].interval_ns, 0);
+    atomic_init(&pool->classes[c].tolerance_ns, 0);
+    atomic_init(&pool->classes[c].tat, 0);
+  }
+  atomic_init(&pool->class_mask, 0);
+  atomic_init(&pool->class_timer, 0);
   for (size_t i = 0; i < num_threads; ++i) {
-    pthread_create(&pool->threads[i], NULL, worker, pool);
+    atomic_init(&pool->workers[i].completed, 0);
+    atomic_init(&pool->workers[i].active, TICKET_IDLE);
+    atomic_init(&pool->workers[i].xchg_state, XCHG_EMPTY);
+    atomic_init(&pool->workers[i].xchg_handed, 0);
+    atomic_init(&pool->workers[i].idle_next, 0);
+    atomic_init(&pool->workers[i].poll_ns, mpmc_spin_cal.single_cpu ? 0 : MPMC_IDLE_SPIN_NS);
+    atomic_init(&pool->workers[i].local_head, 0);
+    atomic_init(&pool->workers[i].local_tail, 0);
+    atomic_init(&pool->workers[i].local_pushed, 0);
+    atomic_init(&pool->workers[i].cpu, -1);
+    pool->workers[i].tick = 0;
+    pool->workers[i].pool = pool;
+  }
+  for (size_t i = 0; i < num_threads; ++i) {
+    pthread_create(&pool->threads[i], NULL, worker, &pool->workers[i]);
   }
   return pool;
 }
@@ -211,12 +1241,7 @@ void pool_destroy(pool_t *pool, int wait_for_jobs) {
   // Stop accepting new submissions immediately
   atomic_store_explicit(&pool->accepting, 0, memory_order_release);
 
-  if (wait_for_jobs) {
-    // Wait efficiently until all queued jobs finish
-    while (atomic_load_explicit(&pool->queued, memory_order_acquire) > 0 ||
-         atomic_load_explicit(&pool->busy, memory_order_acquire) > 0) {
-    }
-  }
+  if (wait_for_jobs) pool_wait(pool);
 
   // Enqueue one poison-pill per worker to ensure each thread wakes and exits.
   // Use blocking enqueue so we ensure the poison pills are actually placed.
@@ -225,7 +1250,8 @@ void pool_destroy(pool_t *pool, int wait_for_jobs) {
     // This will block until there's space. Since we either waited for the queue to
     // drain (wait_for_jobs) or we have stopped accepting new submissions, this will
     // succeed in a finite time.
-    (void)mpmc_enqueue_blocking(pool->q, poison);
+    (void)mpmc_enqueue_blocking(pool->q, poison, &pool->backoff);
+    pool_wake_one(pool);
   }
 
   // Now mark running = 0 (workers will exit when they dequeue poison)
@@ -234,34 +1260,475 @@ void pool_destroy(pool_t *pool, int wait_for_jobs) {
   // Join threads
   for (size_t i = 0; i < pool->n_threads; ++i) pthread_join(pool->threads[i], NULL);
 
+  for (size_t i = 0; i < pool->n_threads; ++i) mpmc_sem_destroy(&pool->workers[i].wake);
+  mpmc_sem_destroy(&pool->timer_sem);
+  for (size_t c = 0; c < POOL_CLASSES; ++c)
+    mpmc_queue_destroy(atomic_load_explicit(&pool->classes[c].q, memory_order_relaxed));
+  pool_topo_free(&pool->topo);
+  free(atomic_load_explicit(&pool->coalesce, memory_order_relaxed));
+  credit_queue_destroy(atomic_load_explicit(&pool->credit, memory_order_relaxed));
   free(pool->threads);
+  free(pool->workers_mem);
+  free(pool->fc_mem);
   mpmc_queue_destroy(pool->q);
   free(pool);
 }
 
 
+// Combiner pass: enqueue every pending request with one claim and hand back
+// the results. Called with fc_lock held.
+static void fc_combine(pool_t *pool) {
+  size_t idx[FC_SLOTS];
+  job_t jobs[FC_SLOTS];
+  size_t n = 0;
+  for (size_t i = 0; i < FC_SLOTS; ++i) {
+    if (atomic_load_explicit(&pool->fc[i].state, memory_order_acquire) == FC_PENDING) {
+      idx[n] = i;
+      jobs[n++] = pool->fc[i].job;
+    }
+  }
+  if (n == 0) return;
+
+  size_t first = 0;
+  size_t k = mpmc_enqueue_batch(pool->q, jobs, n, &first);
+  for (size_t i = 0; i < n; ++i) {
+    fc_slot_t *slot = &pool->fc[idx[i]];
+    slot->ticket = first + i;
+    atomic_store_explicit(&slot->state, i < k ? FC_DONE : FC_FULL, memory_order_release);
+  }
+
+  // Batches of one mean nobody is queueing behind the combiner any more. The
+  // heat is a heuristic, so racing with direct submits' increments is fine.
+  int heat = atomic_load_explicit(&pool->fc_heat, memory_order_relaxed);
+  heat = n > 1 ? heat + 1 : heat - 8;
+  if (heat > FC_HEAT_MAX) heat = FC_HEAT_MAX;
+  if (heat <= 0) {
+    heat = 0;
+    atomic_store_explicit(&pool->fc_enabled, 0, memory_order_relaxed);
+  }
+  atomic_store_explicit(&pool->fc_heat, heat, memory_order_relaxed);
+}
+
+// Submit through the combiner. Returns 0/-1 like mpmc_enqueue_pos(), or 1 if
+// this thread's request slot is taken (another thread hashed to it), in
+// which case the caller submits directly.
+static int fc_submit(pool_t *pool, job_t job, size_t *ticket) {
+  fc_slot_t *slot = &pool->fc[submitter_id() % FC_SLOTS];
+  size_t st = FC_EMPTY;
+  if (!atomic_compare_exchange_strong_explicit(&slot->state, &st, FC_CLAIMED,
+    memory_order_acquire, memory_order_relaxed))
+    return 1;
+  slot->job = job;
+  atomic_store_explicit(&slot->state, FC_PENDING, memory_order_release);
+
+  for (;;) {
+    int unlocked = 0;
+    if (atomic_compare_exchange_strong_explicit(&pool->fc_lock, &unlocked, 1,
+      memory_order_acquire, memory_order_relaxed)) {
+      fc_combine(pool);
+      atomic_store_explicit(&pool->fc_lock, 0, memory_order_release);
+    }
+    st = atomic_load_explicit(&slot->state, memory_order_acquire);
+    if (st == FC_DONE || st == FC_FULL) break;
+    mpmc_spin_until_change(&slot->state, st, MPMC_PUBLISH_WAIT_NS);
+  }
+  if (ticket && st == FC_DONE) *ticket = slot->ticket;
+  atomic_store_explicit(&slot->state, FC_EMPTY, memory_order_release);
+  return st == FC_DONE ? 0 : -1;
+}
+
+// Enqueue a job: on the calling worker's own ring when submitted from a job,
+// straight to an idle worker when the pool is underloaded (a spinning one,
+// else a parked one), through the combiner when producers contend, on the
+// global ring otherwise. Jobs that need a ticket always go through the global
+// ring. A job put on a ring wakes one parked worker unless a spinning one
+// will pick it up.
+static int pool_enqueue(pool_t *pool, job_t job, size_t *ticket) {
+  worker_t *self = current_worker;
+  if (!ticket && self && self->pool == pool && local_push(self, job) == 0) {
+    pool_wake_ring(pool);
+    return 0;
+  }
+  if (!ticket) {
+    if (pool_exchange_offer(pool, job) == 0) return 0;
+    if (pool_ring_empty(pool) && pool_handoff(pool, job) == 0) return 0;
+  }
+
+  if (atomic_load_explicit(&pool->fc_enabled, memory_order_relaxed)) {
+    int ret = fc_submit(pool, job, ticket);
+    if (ret == 0) pool_wake_ring(pool);
+    if (ret <= 0) return ret;
+  }
+
+  size_t lost = 0;
+  int ret = mpmc_enqueue_pos(pool->q, job, ticket, &lost);
+  if (ret == 0) pool_wake_ring(pool);
+  // Only contended submits touch the heat counter, and combining never pays
+  // off on a single CPU, where the combiner's waiters cannot run.
+  if (lost >= FC_LOST_THRESHOLD && !mpmc_spin_cal.single_cpu &&
+      atomic_load_explicit(&pool->fc_heat, memory_order_relaxed) < FC_HEAT_MAX) {
+    int heat = atomic_fetch_add_explicit(&pool->fc_heat, 2, memory_order_relaxed) + 2;
+    if (heat >= FC_HEAT_ON) atomic_store_explicit(&pool->fc_enabled, 1, memory_order_relaxed);
+  }
+  return ret;
+}
+
 int pool_submit(pool_t *pool, job_fn fn, void *arg) {
-  if (!atomic_load_explicit(&pool->accepting, memory_order_acquire)) return -1;
+  if (!atomic_load_explicit(&pool->accepting, memory_order_relaxed)) return -1;
 
   job_t job = { .func = fn, .arg = arg };
-  int ret = mpmc_enqueue_nb(pool->q, job);
-  if (ret == 0)
-    atomic_fetch_add_explicit(&pool->queued, 1, memory_order_relaxed);
-  return ret;
+  return pool_enqueue(pool, job, NULL);
+}
+
+int pool_submit_ticket(pool_t *pool, job_fn fn, void *arg, pool_ticket_t *ticket) {
+  if (!atomic_load_explicit(&pool->accepting, memory_order_relaxed)) return -1;
+
+  job_t job = { .func = fn, .arg = arg };
+  return pool_enqueue(pool, job, ticket);
 }
 
 int pool_submit_blocking(pool_t *pool, job_fn fn, void *arg) {
-  if (!atomic_load_explicit(&pool->accepting, memory_order_acquire)) return -1;
+  if (!atomic_load_explicit(&pool->accepting, memory_order_relaxed)) return -1;
 
   job_t job = { .func = fn, .arg = arg };
-  int ret = mpmc_enqueue_blocking(pool->q, job);
-  if (ret == 0)
-    atomic_fetch_add_explicit(&pool->queued, 1, memory_order_relaxed);
-  return ret;
+  mpmc_backoff_t b;
+  mpmc_backoff_init(&b, &pool->backoff);
+  while (pool_enqueue(pool, job, NULL) != 0) mpmc_full_backoff(pool->q, &b);
+  return 0;
 }
 
+/*
+ * Coalescing. Pending keys live in an open-addressed table of COALESCE_SLOTS
+ * slots, each key probing COALESCE_PROBES slots from its hash. A slot's
+ * `state` is 0 (free), COALESCE_BUSY while a submitter fills it in and
+ * enqueues its job, or the key once the job is queued. A submit that finds
+ * its key drops the job; the queued one has not started yet, so it still
+ * runs after the caller's submit. The job frees the slot as it starts, after
+ * copying out the function and argument, so a submit racing with it either
+ * is dropped before the start or queues a new job.
+ *
+ * A key is only published after its job is queued, so a failed enqueue never
+ * leaves dropped duplicates behind; a job that starts before its submitter
+ * gets there waits for the key. Submits that see the slot BUSY, or find
+ * every probed slot taken by other keys, queue their job uncoalesced.
+ */
+#define COALESCE_SLOTS 1024
+#define COALESCE_PROBES 8
+#define COALESCE_BUSY SIZE_MAX
+
+struct coalesce_slot {
+  atomic_size_t state;  // 0, COALESCE_BUSY or the pending key
+  job_t job;
+  char pad[32 - sizeof(atomic_size_t) - sizeof(job_t)];
+};
+
+static void coalesce_run(void *arg) {
+  struct coalesce_slot *slot = (struct coalesce_slot *)arg;
+  job_t job = slot->job;
+  size_t st = atomic_load_explicit(&slot->state, memory_order_relaxed);
+  if (st == COALESCE_BUSY) {
+    // The submitter is between its enqueue and publishing the key, where it
+    // may be preempted, so back off under the pool's policy like the other
+    // waits. Jobs only run on the pool's workers.
+    mpmc_backoff_t b;
+    mpmc_backoff_init(&b, &current_worker->pool->backoff);
+    while ((st = atomic_load_explicit(&slot->state, memory_order_relaxed)) == COALESCE_BUSY)
+      mpmc_backoff_wait(&b, 1, &slot->state, st);
+  }
+  // release: the copy above is done before a new owner refills the slot.
+  atomic_store_explicit(&slot->state, 0, memory_order_release);
+  job.func(job.arg);
+}
+
+static struct coalesce_slot *coalesce_table(pool_t *pool) {
+  struct coalesce_slot *t = atomic_load_explicit(&pool->coalesce, memory_order_acquire);
+  if (t) return t;
+  struct coalesce_slot *fresh = calloc(COALESCE_SLOTS, sizeof(*fresh));
+  if (!fresh) return NULL;
+  if (atomic_compare_exchange_strong_explicit(&pool->coalesce, &t, fresh,
+    memory_order_acq_rel, memory_order_acquire))
+    return fresh;
+  free(fresh);
+  return t;
+}
+
+int pool_submit_coalesced(pool_t *pool, size_t key, job_fn fn, void *arg) {
+  if (!atomic_load_explicit(&pool->accepting, memory_order_relaxed)) return -1;
+  job_t job = { .func = fn, .arg = arg };
+  struct coalesce_slot *table = coalesce_table(pool);
+  if (!table || key == 0 || key == COALESCE_BUSY) return pool_enqueue(pool, job, NULL);
+
+  size_t h = (size_t)(((uint64_t)key * 0x9E3779B97F4A7C15ull) >> 32);
+  for (;;) {
+    struct coalesce_slot *free_slot = NULL;
+    for (size_t i = 0; i < COALESCE_PROBES; ++i) {
+      struct coalesce_slot *slot = &table[(h + i) % COALESCE_SLOTS];
+      size_t st = atomic_load_explicit(&slot->state, memory_order_relaxed);
+      if (st == key) return 1;
+      if (st == 0 && !free_slot) free_slot = slot;
+    }
+    if (!free_slot) return pool_enqueue(pool, job, NULL);
+
+    size_t st = 0;
+    if (!atomic_compare_exchange_strong_explicit(&free_slot->state, &st, COALESCE_BUSY,
+      memory_order_acquire, memory_order_relaxed))
+      continue;  // lost the slot, look again
+    free_slot->job = job;
+    job_t run = { .func = coalesce_run, .arg = free_slot };
+    if (pool_enqueue(pool, run, NULL) != 0) {
+      atomic_store_explicit(&free_slot->state, 0, memory_order_relaxed);
+      return -1;
+    }
+    atomic_store_explicit(&free_slot->state, key, memory_order_relaxed);
+    return 0;
+  }
+}
+
+int pool_set_class_rate(pool_t *pool, unsigned cls, unsigned per_sec, unsigned burst) {
+  if (cls >= POOL_CLASSES) return -1;
+  job_class_t *c = &pool->classes[cls];
+  if (!atomic_load_explicit(&c->q, memory_order_relaxed)) {
+    mpmc_queue_t *q = mpmc_queue_create(pool->q->capacity);
+    if (!q) return -1;
+    atomic_store_explicit(&c->q, q, memory_order_relaxed);
+  }
+  uint64_t interval = per_sec ? 1000000000u / per_sec : 0;
+  if (per_sec && !interval) interval = 1;
+  atomic_store_explicit(&c->interval_ns, interval, memory_order_relaxed);
+  atomic_store_explicit(&c->tolerance_ns, (uint64_t)(burst ? burst - 1 : 0) * interval,
+                        memory_order_relaxed);
+  // release: publishes the queue and the rate to workers reading the mask.
+  atomic_fetch_or_explicit(&pool->class_mask, 1u << cls, memory_order_release);
+  // A lower rate may let jobs start now; the class timer recomputes its wait.
+  pool_wake_timer(pool);
+  return 0;
+}
+
+int pool_submit_class(pool_t *pool, unsigned cls, job_fn fn, void *arg) {
+  if (!atomic_load_explicit(&pool->accepting, memory_order_relaxed)) return -1;
+  if (cls >= POOL_CLASSES ||
+      !(atomic_load_explicit(&pool->class_mask, memory_order_acquire) & (1u << cls)))
+    return -1;
+  job_t job = { .func = fn, .arg = arg };
+  mpmc_queue_t *q = atomic_load_explicit(&pool->classes[cls].q, memory_order_relaxed);
+  size_t pos;
+  if (mpmc_enqueue_pos(q, job, &pos, NULL) != 0) return -1;
+  // The class timer only waits for classes that had jobs when it went to
+  // sleep; this one may have to start sooner.
+  if (pos == atomic_load_explicit(&q->dequeue_pos, memory_order_seq_cst))
+    pool_wake_timer(pool);
+  pool_hint_work(pool);
+  pool_wake_ring(pool);
+  return 0;
+}
+
+int pool_acquire_credits(pool_t *pool, size_t n, long timeout_ns) {
+  if (!atomic_load_explicit(&pool->accepting, memory_order_relaxed)) return -1;
+  credit_queue_t *c = pool_credit_queue(pool);
+  return c ? credit_acquire(c, n, timeout_ns) : -1;
+}
+
+void pool_release_credits(pool_t *pool, size_t n) {
+  credit_queue_t *c = atomic_load_explicit(&pool->credit, memory_order_acquire);
+  // No queue yet means no credits were ever handed out.
+  if (c) credit_release(c, n);
+}
+
+void pool_submit_credited(pool_t *pool, job_fn fn, void *arg) {
+  job_t job = { .func = fn, .arg = arg };
+  mpmc_enqueue_reserved(atomic_load_explicit(&pool->credit, memory_order_acquire)->q, job);
+  pool_hint_work(pool);
+  pool_wake_ring(pool);
+}
+
+// Quiescence is detected in two phases. First take a submission ticket (the
+// ring position) and wait for the per-worker completion counts to reach it;
+// this polls only worker-owned lines and leaves the producers' enqueue_pos
+// line alone. Completions of later jobs can satisfy that bound early, and
+// jobs may have spawned more work, so the result is confirmed with the exact
+// completions-then-submissions check before returning.
 void pool_wait(pool_t *pool) {
-  while (atomic_load_explicit(&pool->queued, memory_order_acquire) > 0 ||
-       atomic_load_explicit(&pool->busy, memory_order_acquire) > 0) {
+  mpmc_backoff_t b;
+  mpmc_backoff_init(&b, &pool->backoff);
+  for (;;) {
+    size_t ticket = pool_submitted(pool), done;
+    while ((done = pool_completed(pool)) < ticket)
+      mpmc_backoff_wait(&b, ticket - done, NULL, 0);
+    if (pool_idle(pool)) return;
+  }
+}
+
+void pool_wait_until(pool_t *pool, pool_ticket_t ticket) {
+  mpmc_backoff_t b;
+  mpmc_backoff_init(&b, &pool->backoff);
+  size_t mark;
+  while ((mark = pool_watermark(pool)) <= ticket)
+    mpmc_backoff_wait(&b, ticket - mark + 1, NULL, 0);
+}
+
+/*
+ * Fork/join. A spawned child is an ordinary job whose argument is its
+ * pool_task_t; running it decrements the frame's `pending` count (release),
+ * which pool_sync() reads with acquire.
+ *
+ * pool_sync() on a worker runs other jobs while it waits: its own ring, then
+ * stolen ones, then the global ring, where children go once the local ring is
+ * full. A job from the global ring only takes over the worker's `active`
+ * claim if the job calling pool_sync() holds none; otherwise that job's
+ * ticket is older and keeps the watermark below both.
+ */
+static void task_run(void *arg) {
+  pool_task_t *task = (pool_task_t *)arg;
+  pool_frame_t *frame = task->frame;
+  task->fn(task->arg);
+  // `task` may be gone as soon as the count drops.
+  atomic_fetch_sub_explicit(&frame->pending, 1, memory_order_release);
+}
+
+// Run one queued job from inside pool_sync(). Returns 0 if there was none.
+static int worker_help(pool_t *pool, worker_t *self) {
+  job_t job;
+  if (local_take(self, &job) == 0 || pool_steal(pool, self, &job) == 0) {
+    job.func(job.arg);
+    worker_completed(self);
+    return 1;
+  }
+  int idle = atomic_load_explicit(&self->active, memory_order_relaxed) == TICKET_IDLE;
+  if (mpmc_dequeue_try(pool->q, &job, idle ? &self->active : NULL) != 0) return 0;
+  if (job.func == NULL) {
+    // A poison pill is for the worker loop: put it back.
+    if (idle) atomic_store_explicit(&self->active, TICKET_IDLE, memory_order_release);
+    (void)mpmc_enqueue_blocking(pool->q, job, &pool->backoff);
+    pool_wake_ring(pool);
+    return 0;
   }
-}
\ No newline at end of file
+  job.func(job.arg);
+  worker_completed(self);
+  if (idle) atomic_store_explicit(&self->active, TICKET_IDLE, memory_order_release);
+  return 1;
+}
+
+void pool_frame_init(pool_frame_t *frame, pool_t *pool) {
+  frame->pool = pool;
+  atomic_init(&frame->pending, 0);
+}
+
+void pool_spawn(pool_frame_t *frame, pool_task_t *task, job_fn fn, void *arg) {
+  pool_t *pool = frame->pool;
+  task->fn = fn;
+  task->arg = arg;
+  task->frame = frame;
+  atomic_fetch_add_explicit(&frame->pending, 1, memory_order_relaxed);
+  job_t job = { task_run, task };
+  if (!atomic_load_explicit(&pool->accepting, memory_order_relaxed) ||
+      pool_enqueue(pool, job, NULL) != 0)
+    task_run(task);
+}
+
+void pool_sync(pool_frame_t *frame) {
+  pool_t *pool = frame->pool;
+  worker_t *self = current_worker;
+  if (self && self->pool != pool) self = NULL;
+  mpmc_backoff_t b;
+  mpmc_backoff_init(&b, &pool->backoff);
+  size_t pending;
+  while ((pending = atomic_load_explicit(&frame->pending, memory_order_acquire)) > 0) {
+    if (self && worker_help(pool, self)) {
+      mpmc_backoff_init(&b, &pool->backoff);
+      continue;
+    }
+    mpmc_backoff_wait(&b, pending, &frame->pending, pending);
+  }
+}
+
+/*
+ * Streams. pool_run_stream() pulls jobs from the generator in batches of up
+ * to STREAM_BATCH, one pump job at a time. The pump holding the stream pulls
+ * a batch, hands the stream on to a fresh pump and only then runs its batch,
+ * so pulling and running overlap while `next` is never called concurrently,
+ * and no pump ever waits for another: a generator blocked on I/O holds up
+ * one worker, not all of them. If the next pump cannot be queued, the
+ * current one keeps the stream and pulls again after its batch. Queueing the
+ * pump orders the generator's state between pumps. Jobs run inside their
+ * pump, so pool_wait() covers them through the pumps.
+ */
+#define STREAM_BATCH 8
+
+typedef struct {
+  pool_t *pool;
+  pool_next_fn next;
+  void *ctx;
+  atomic_size_t pumps;  // pumps queued or running
+  mpmc_sem_t finished;  // posted by the last pump to finish
+} stream_t;
+
+static void stream_pump(void *arg) {
+  stream_t *st = (stream_t *)arg;
+  pool_t *pool = st->pool;
+  job_t batch[STREAM_BATCH];
+  int dry = 0, handed = 0;
+  while (!dry && !handed) {
+    size_t n = 0;
+    while (n < STREAM_BATCH && st->next(st->ctx, &batch[n]) == 0) ++n;
+    dry = n < STREAM_BATCH;
+    if (!dry) {
+      atomic_fetch_add_explicit(&st->pumps, 1, memory_order_relaxed);
+      job_t pump = { stream_pump, st };
+      handed = atomic_load_explicit(&pool->accepting, memory_order_relaxed) &&
+               pool_enqueue(pool, pump, NULL) == 0;
+      if (!handed) atomic_fetch_sub_explicit(&st->pumps, 1, memory_order_relaxed);
+    }
+    for (size_t i = 0; i < n; ++i) batch[i].func(batch[i].arg);
+  }
+  // `st` lives on the caller's stack and may be gone once the count drops,
+  // unless this pump is the last one, which the caller waits for.
+  if (atomic_fetch_sub_explicit(&st->pumps, 1, memory_order_acq_rel) == 1)
+    mpmc_sem_post(&st->finished);
+}
+
+int pool_run_stream(pool_t *pool, pool_next_fn next, void *ctx) {
+  if (!atomic_load_explicit(&pool->accepting, memory_order_relaxed)) return -1;
+  stream_t st = { .pool = pool, .next = next, .ctx = ctx };
+  atomic_init(&st.pumps, 1);
+  if (mpmc_sem_init(&st.finished, 0) != 0) return -1;
+  job_t pump = { stream_pump, &st };
+  if (pool_enqueue(pool, pump, NULL) != 0) stream_pump(&st);
+
+  // A worker of this pool runs jobs while it waits, as in pool_sync(), so a
+  // stream started from a job cannot leave the pool short of the worker
+  // that should run its pumps. Other callers sleep.
+  worker_t *self = current_worker;
+  if (self && self->pool == pool) {
+    mpmc_backoff_t b;
+    mpmc_backoff_init(&b, &pool->backoff);
+    size_t pumps;
+    while ((pumps = atomic_load_explicit(&st.pumps, memory_order_acquire)) > 0) {
+      if (worker_help(pool, self)) {
+        mpmc_backoff_init(&b, &pool->backoff);
+        continue;
+      }
+      mpmc_backoff_wait(&b, pumps, &st.pumps, pumps);
+    }
+  }
+  while (mpmc_sem_wait(&st.finished) != 0) {
+  }
+  mpmc_sem_destroy(&st.finished);
+  return 0;
+}
+
+int pool_set_backoff(pool_t *pool, const pool_backoff_t *policy) {
+  if (!policy || policy->min_ns == 0 || policy->max_ns < policy->min_ns) return -1;
+  pool->backoff = *policy;
+  return 0;
+}
+
+int pool_set_idle_policy(pool_t *pool, const pool_idle_policy_t *policy) {
+  if (!policy) return -1;
+  for (size_t i = 0; i < pool->n_threads; ++i) {
+    unsigned ns = i < policy->hot_workers ? policy->hot_ns : policy->cold_ns;
+    atomic_store_explicit(&pool->workers[i].poll_ns, ns, memory_order_relaxed);
+  }
+  // Parked workers go back through the idle loop to pick up their window.
+  for (size_t i = 0; i < pool->n_threads; ++i) pool_wake_one(pool);
+  return 0;
+}
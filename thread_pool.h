@@ -23,7 +23,10 @@
 // Platform-specific spin hint
 #if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
   #define SPIN_HINT() __asm__ volatile("pause" ::: "memory")
-#elif defined(__aarch64__) || defined(__arm__)
+#elif defined(__aarch64__)
+  // `yield` is a no-op on most cores; `isb` stalls for a short, bounded time.
+  #define SPIN_HINT() __asm__ volatile("isb sy" ::: "memory")
+#elif defined(__arm__)
   #define SPIN_HINT() __asm__ volatile("yield" ::: "memory")
 #else
   #define SPIN_HINT() do { } while (0)
@@ -36,9 +39,65 @@ typedef struct {
   void *arg;
 } job_t;
 
+// Backoff policy used by every path that waits on the pool (blocking submit,
+// pool_wait(), pool_wait_until(), ...). Each round of waiting lasts:
+//   EXPONENTIAL:  min_ns << round
+//   FIXED:        min_ns
+//   PROPORTIONAL: min_ns * distance, where distance is how far the waiter is
+//                 from its goal (jobs still pending, slots still to be freed)
+// capped at max_ns and, with `jitter`, drawn uniformly from [wait/2, wait] so
+// waiters that started together spread out. Once a waiter has spun for
+// `spin_limit_ns` in total it yields the CPU each round instead.
+typedef enum {
+  POOL_BACKOFF_EXPONENTIAL,
+  POOL_BACKOFF_FIXED,
+  POOL_BACKOFF_PROPORTIONAL,
+} pool_backoff_kind_t;
+
+typedef struct {
+  pool_backoff_kind_t kind;
+  unsigned min_ns;
+  unsigned max_ns;
+  unsigned spin_limit_ns;
+  int jitter;
+} pool_backoff_t;
+
+// Idle policy: how long a worker that runs out of work keeps polling for new
+// jobs before it parks. Workers with index < hot_workers poll for hot_ns, the
+// others for cold_ns; 0 parks at once. A polling worker takes the first job
+// of a burst with no wakeup latency but keeps its core busy, so a pool can
+// keep one hot worker (hot_workers = 1, cold_ns = 0) while the rest sleep.
+typedef struct {
+  size_t hot_workers;
+  unsigned hot_ns;
+  unsigned cold_ns;
+} pool_idle_policy_t;
+
 // Opaque pool type
 typedef struct pool pool_t;
 
+// Job generator for pool_run_stream(): fill `*job` (func must be non-NULL)
+// and return 0, or return non-zero once the stream is exhausted.
+typedef int (*pool_next_fn)(void *ctx, job_t *job);
+
+// Fork/join frame for pool_spawn() / pool_sync(), usually on the stack of the
+// function that spawns. Initialize with pool_frame_init().
+typedef struct {
+  pool_t *pool;
+  atomic_size_t pending;
+} pool_frame_t;
+
+// A spawned child. Must stay alive until the pool_sync() on its frame
+// returns, so it also usually lives on the spawner's stack.
+typedef struct {
+  job_fn fn;
+  void *arg;
+  pool_frame_t *frame;
+} pool_task_t;
+
+// Monotonically increasing position of a submitted job, see pool_submit_ticket().
+typedef size_t pool_ticket_t;
+
 // Create a pool with `num_threads` worker threads and queue capacity `capacity`.
 // Capacity must be > 1 and will be rounded up to the next power of two.
 // Returns NULL on allocation failure.
@@ -50,12 +109,100 @@ pool_t *pool_create(size_t num_threads, size_t capacity);
 void pool_destroy(pool_t *pool, int wait_for_jobs);
 
 // Submit a job non-blocking. Returns 0 on success, -1 if queue is full or pool not running.
+// Called from inside a job, the job goes on the worker's own ring (FIFO, and
+// idle workers take from it) unless that is full.
 int pool_submit(pool_t *pool, job_fn fn, void *arg);
 
+// Like pool_submit(), and on success stores the job's ticket in `*ticket`
+// (if non-NULL). Tickets increase in submission order across all producers.
+int pool_submit_ticket(pool_t *pool, job_fn fn, void *arg, pool_ticket_t *ticket);
+
 // Submit a job but block until there is space. Returns 0 on success, -1 on error.
 int pool_submit_blocking(pool_t *pool, job_fn fn, void *arg);
 
+// Submit fn(arg) unless a job submitted under the same `key` is still
+// pending, i.e. has not started yet; then the new one is dropped, since the
+// pending job will run after this call anyway (with its own fn and arg).
+// Keys are cleared as their job starts, so a job may resubmit its own key.
+// Keys 0 and SIZE_MAX are not coalesced. Returns 0 if the job was queued, 1
+// if it was dropped as a duplicate, -1 like pool_submit().
+int pool_submit_coalesced(pool_t *pool, size_t key, job_fn fn, void *arg);
+
+// Rate-limited job classes, numbered 0 .. POOL_CLASSES - 1. Each class has
+// its own queue (as large as the pool's) and lets at most `per_sec` jobs
+// start per second, with bursts of up to `burst` at once; 0 per second means
+// no limit. Jobs over the rate wait in the queue while workers run other
+// work, so there is no need to sleep inside them. pool_set_class_rate()
+// creates the class on first use and returns -1 if `cls` is out of range or
+// the queue cannot be allocated; later calls only change the rate. Set a
+// class up before submitting to it, from one thread.
+// pool_submit_class() returns -1 if the class is not set up, its queue is
+// full or the pool is not accepting jobs. pool_wait() covers class jobs, so
+// it may wait as long as the rate requires.
+#define POOL_CLASSES 8
+int pool_set_class_rate(pool_t *pool, unsigned cls, unsigned per_sec, unsigned burst);
+int pool_submit_class(pool_t *pool, unsigned cls, job_fn fn, void *arg);
+
+// Credit-based flow control. A credit reserves one slot of a separate queue
+// for credited jobs, so credit holders never take space from pool_submit()
+// and friends. The first pool_acquire_credits() creates that queue, with the
+// pool's capacity (rounded up) as its number of credits. It takes `n`
+// credits, sleeping until enough are free or `timeout_ns` passes (0 only
+// tries, negative waits forever), and returns 0 on success, -1 on timeout, if
+// `n` exceeds the pool's credits, if the queue cannot be allocated or if the
+// pool is not accepting jobs. Each pool_submit_credited() then spends one
+// credit and cannot fail; the credit comes back to the pool once a worker
+// takes the job. Return credits that will not be used with
+// pool_release_credits(). Call pool_submit_credited() only with a credit from
+// a successful pool_acquire_credits() (it does not check that the pool is
+// still accepting jobs); releasing credits before any were acquired does
+// nothing.
+int pool_acquire_credits(pool_t *pool, size_t n, long timeout_ns);
+void pool_release_credits(pool_t *pool, size_t n);
+void pool_submit_credited(pool_t *pool, job_fn fn, void *arg);
+
+// Start a fork/join frame on `pool`.
+void pool_frame_init(pool_frame_t *frame, pool_t *pool);
+
+// Run fn(arg) as a child of `frame`, using `task` as its storage. From inside
+// a job the child goes on the worker's own ring; if it cannot be queued at
+// all it runs inline before pool_spawn() returns.
+void pool_spawn(pool_frame_t *frame, pool_task_t *task, job_fn fn, void *arg);
+
+// Wait until every child spawned on `frame` has finished. Inside a job the
+// worker runs queued jobs (its own first, then stolen ones) instead of
+// blocking, so recursive spawn/sync cannot run out of workers. Unlike
+// pool_wait(), this is safe to call from a job.
+void pool_sync(pool_frame_t *frame);
+
+// Run every job produced by `next` and return once all have finished. There
+// is no producer thread and the jobs never occupy the queue: workers take
+// turns pulling a small batch from the generator, each passing it on before
+// running its batch, so `next` is never called concurrently, needs no
+// locking of its own and may block (on I/O, say) without other workers
+// spinning for their turn. A caller that is not a worker of the pool
+// sleeps until the stream is done. Returns 0, or -1 if the pool is not
+// accepting jobs or the stream's semaphore cannot be created.
+int pool_run_stream(pool_t *pool, pool_next_fn next, void *ctx);
+
+// Replace the pool's backoff policy (the default is exponential from 64ns to
+// 16us, yielding after 200us, with jitter). Returns -1 if the policy is
+// invalid (min_ns == 0 or max_ns < min_ns). Call while no thread is waiting on
+// the pool.
+int pool_set_backoff(pool_t *pool, const pool_backoff_t *policy);
+
+// Replace the pool's idle policy (the default polls 10us on every worker, or
+// not at all on a single CPU). Takes effect the next time each worker runs
+// out of work. Returns -1 if `policy` is NULL.
+int pool_set_idle_policy(pool_t *pool, const pool_idle_policy_t *policy);
+
 // Wait until all currently queued jobs are finished.
 void pool_wait(pool_t *pool);
 
+// Wait until every job with a ticket up to and including `ticket` has
+// finished. Jobs submitted afterwards (by any thread) are not waited for, so
+// a steady stream of new submissions cannot starve the caller. Must not be
+// called from a job whose own ticket is <= `ticket`.
+void pool_wait_until(pool_t *pool, pool_ticket_t ticket);
+
 #endif // LOCKLESS_JOB_POOL_H
\ No newline at end of file